@@ -0,0 +1,514 @@
+/*
+Sphynx Operating System
+
+File: bench.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Hosted benchmarks for the kernel's string routines, tar parser and LZ4 decoder
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Kernel headers see the prefixed names, everything after the undefs talks to glibc
+#include "rename.h"
+#include <string.hpp>
+#include <data/tar.hpp>
+#include <data/lz4.hpp>
+#undef memset
+#undef memcpy
+#undef memmove
+#undef memcmp
+#undef strlen
+#undef strcmp
+#undef strncmp
+#undef strcpy
+#undef strcat
+#undef strncpy
+#undef strchr
+#undef strrchr
+#undef strstr
+
+typedef struct {
+    const char* suite;
+    const char* function;
+    const char* impl;
+    size_t size;
+    const char* align;
+    double nsPerCall;
+    double gbPerSec;
+} result_t;
+
+static result_t results[4096];
+static size_t resultCount = 0;
+// Minimum wall time per sample, raised for stable numbers or lowered with --quick
+static double minSampleNs = 20e6;
+static const int samples = 5;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Best of several samples, each long enough to hide timer overhead
+template <typename F>
+static double measure(F&& f) {
+    uint64_t iterations = 1;
+    while (true) {
+        double start = now_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            f();
+        }
+        if (now_ns() - start >= minSampleNs / 10) {
+            break;
+        }
+        iterations *= 2;
+    }
+    iterations *= 10;
+
+    double best = 1e300;
+    for (int s = 0; s < samples; s++) {
+        double start = now_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            f();
+        }
+        double ns = (now_ns() - start) / iterations;
+        if (ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+static void record(const char* suite, const char* function, const char* impl, size_t size, const char* align, double ns, size_t bytes) {
+    if (resultCount == sizeof(results) / sizeof(results[0])) {
+        fprintf(stderr, "bench: result table full\n");
+        exit(1);
+    }
+    results[resultCount++] = { suite, function, impl, size, align, ns, bytes ? bytes / ns : 0.0 };
+}
+
+typedef void* (*copy_fn)(void*, const void*, size_t);
+typedef void* (*set_fn)(void*, int, size_t);
+typedef size_t (*len_fn)(const char*);
+typedef int (*cmp_fn)(const char*, const char*);
+typedef const char* (*chr_fn)(const char*, int);
+typedef const char* (*str_fn)(const char*, const char*);
+
+// glibc's C++ overloads of strchr/strstr return char*, wrap them to match the kernel signatures
+static const char* glibc_strchr(const char* s, int c) { return strchr(s, c); }
+static const char* glibc_strrchr(const char* s, int c) { return strrchr(s, c); }
+static const char* glibc_strstr(const char* h, const char* n) { return strstr(h, n); }
+
+static const size_t memSizes[] = { 8, 64, 256, 1024, 4096, 65536, 1048576 };
+static const size_t strSizes[] = { 16, 64, 256, 1024, 4096, 65536 };
+static const struct { const char* name; size_t dst; size_t src; } alignments[] = {
+    { "0/0", 0, 0 }, { "1/1", 1, 1 }, { "3/0", 3, 0 },
+};
+
+static unsigned char* bufA;
+static unsigned char* bufB;
+
+static void bench_memory() {
+    struct { const char* impl; copy_fn copy; copy_fn move; set_fn set; } impls[] = {
+        { "sphynx", sphynx_memcpy, sphynx_memmove, sphynx_memset },
+        { "glibc", memcpy, memmove, memset },
+    };
+
+    for (auto& impl : impls) {
+        copy_fn volatile copy = impl.copy;
+        copy_fn volatile move = impl.move;
+        set_fn volatile set = impl.set;
+        for (size_t size : memSizes) {
+            for (auto& a : alignments) {
+                unsigned char* d = bufB + a.dst;
+                unsigned char* s = bufA + a.src;
+                record("memory", "memcpy", impl.impl, size, a.name, measure([&] { copy(d, s, size); }), size);
+                record("memory", "memset", impl.impl, size, a.name, measure([&] { set(d, 0x5A, size); }), size);
+                // Overlapping with dest above src, the case that must copy backward
+                unsigned char* o = bufA + a.dst + size / 2 + 1;
+                record("memory", "memmove_overlap", impl.impl, size, a.name, measure([&] { move(o, s, size); }), size);
+            }
+        }
+    }
+}
+
+static void bench_strings() {
+    struct { const char* impl; len_fn len; cmp_fn cmp; chr_fn chr; chr_fn rchr; str_fn str; } impls[] = {
+        { "sphynx", sphynx_strlen, sphynx_strcmp, sphynx_strchr, sphynx_strrchr, sphynx_strstr },
+        { "glibc", strlen, strcmp, glibc_strchr, glibc_strrchr, glibc_strstr },
+    };
+
+    // A run of 'a' with the needle's tail at the very end is the worst case for a naive search
+    char needle[33];
+    memset(needle, 'a', 31);
+    needle[31] = 'b';
+    needle[32] = '\0';
+
+    for (auto& impl : impls) {
+        len_fn volatile len = impl.len;
+        cmp_fn volatile cmp = impl.cmp;
+        chr_fn volatile chr = impl.chr;
+        chr_fn volatile rchr = impl.rchr;
+        str_fn volatile str = impl.str;
+        for (size_t size : strSizes) {
+            for (auto& a : alignments) {
+                char* s1 = reinterpret_cast<char*>(bufA) + a.dst;
+                char* s2 = reinterpret_cast<char*>(bufB) + a.src;
+                memset(s1, 'a', size - 1);
+                s1[size - 1] = '\0';
+                memcpy(s2, s1, size);
+
+                record("string", "strlen", impl.impl, size, a.name, measure([&] { len(s1); }), size);
+                record("string", "strcmp", impl.impl, size, a.name, measure([&] { cmp(s1, s2); }), size);
+                record("string", "strchr", impl.impl, size, a.name, measure([&] { chr(s1, 'z'); }), size);
+                record("string", "strrchr", impl.impl, size, a.name, measure([&] { rchr(s1, 'a'); }), size);
+                if (size > sizeof(needle)) {
+                    memcpy(s1 + size - sizeof(needle), needle, sizeof(needle));
+                    record("string", "strstr", impl.impl, size, a.name, measure([&] { str(s1, needle); }), size);
+                }
+            }
+        }
+    }
+}
+
+static void octal(char* out, size_t width, uint64_t value) {
+    snprintf(out, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+}
+
+// Builds an archive of count small files named dir/NNNNNN.txt
+static size_t build_tar(unsigned char* out, size_t count) {
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct tar_header* header = reinterpret_cast<struct tar_header*>(out + offset);
+        memset(header, 0, TAR_BLOCK_SIZE);
+        // Every other entry keeps its directory in the ustar prefix field
+        if (i % 2) {
+            snprintf(header->prefix, sizeof(header->prefix), "sys/bench/d%03zu", i % 64);
+            snprintf(header->name, sizeof(header->name), "%06zu.txt", i);
+        } else {
+            snprintf(header->name, sizeof(header->name), "sys/bench/d%03zu/%06zu.txt", i % 64, i);
+        }
+        octal(header->size, sizeof(header->size), 16);
+        header->typeflag = '0';
+        memcpy(header->magic, "ustar", 6);
+        offset += TAR_BLOCK_SIZE;
+        memset(out + offset, 'x', TAR_BLOCK_SIZE);
+        offset += TAR_BLOCK_SIZE;
+    }
+    memset(out + offset, 0, 2 * TAR_BLOCK_SIZE);
+    return offset + 2 * TAR_BLOCK_SIZE;
+}
+
+static void bench_tar() {
+    static const size_t counts[] = { 16, 256, 4096, 20000, 50000 };
+    for (size_t count : counts) {
+        size_t bytes = (count * 2 + 2) * TAR_BLOCK_SIZE;
+        unsigned char* image = static_cast<unsigned char*>(aligned_alloc(TAR_BLOCK_SIZE, bytes));
+        size_t size = build_tar(image, count);
+
+        char last[64];
+        snprintf(last, sizeof(last), "sys/bench/d%03zu/%06zu.txt", (count - 1) % 64, count - 1);
+        char first[64];
+        snprintf(first, sizeof(first), "sys/bench/d%03zu/%06zu.txt", static_cast<size_t>(0), static_cast<size_t>(0));
+
+        volatile uint64_t sink = 0;
+        // The linear scan only sees the name field, so it is timed on the entry without a prefix
+        record("tar", "scan_first", "sphynx", count, "-", measure([&] { sink = get_file_tar(image, size, "sys/bench/d000/000000.txt").size; }), 0);
+        if (count <= 4096 || minSampleNs >= 20e6) {
+            record("tar", "scan_missing", "sphynx", count, "-", measure([&] { sink = get_file_tar(image, size, "sys/none").size; }), 0);
+        }
+
+        record("tar", "index_build", "sphynx", count, "-", measure([&] {
+            TarIndex index;
+            index.build(image, size);
+            sink = index.get_count();
+        }), size);
+
+        TarIndex index;
+        if (!index.build(image, size) || !index.lookup(first) || !index.lookup(last) || index.lookup("sys/none")) {
+            fprintf(stderr, "bench: tar index is broken\n");
+            exit(1);
+        }
+        record("tar", "index_first", "sphynx", count, "-", measure([&] { sink = index.lookup(first)->file.size; }), 0);
+        record("tar", "index_last", "sphynx", count, "-", measure([&] { sink = index.lookup(last)->file.size; }), 0);
+        record("tar", "index_missing", "sphynx", count, "-", measure([&] { sink = reinterpret_cast<uint64_t>(index.lookup("sys/none")); }), 0);
+
+        size_t listed = 0;
+        const tar_entry_t* dir = index.lookup("sys/bench/d001");
+        for (const tar_entry_t* child = index.first_child(dir); child; child = index.next_sibling(child)) {
+            listed++;
+        }
+        if (listed != (count + 62) / 64) {
+            fprintf(stderr, "bench: tar index lists %zu children of d001\n", listed);
+            exit(1);
+        }
+        (void)sink;
+        free(image);
+    }
+}
+
+// Frames come from the reference lz4 tool so the decoder is checked against what mkramfs ships, override with LZ4=path
+static const struct { const char* name; const char* flags; } lz4Modes[] = {
+    { "default", "" },
+    { "content_size", "--content-size" },
+    { "linked", "-BD" },
+    { "block64k", "-B4" },
+    { "no_crc", "--no-frame-crc" },
+    { "hc", "-9" },
+};
+
+static unsigned char* lz4_compress(const char* tool, const char* flags, const unsigned char* data, size_t size, size_t* outSize) {
+    char in[] = "/tmp/sphynx-bench-XXXXXX";
+    int fd = mkstemp(in);
+    if (fd < 0 || write(fd, data, size) != static_cast<ssize_t>(size)) {
+        fprintf(stderr, "bench: can't write lz4 input\n");
+        exit(1);
+    }
+    close(fd);
+
+    char out[64];
+    snprintf(out, sizeof(out), "%s.lz4", in);
+    char command[512];
+    snprintf(command, sizeof(command), "%s -q -f %s %s %s 2>/dev/null", tool, flags, in, out);
+    int status = system(command);
+    unlink(in);
+    if (status != 0) {
+        unlink(out);
+        return nullptr;
+    }
+
+    FILE* f = fopen(out, "rb");
+    fseek(f, 0, SEEK_END);
+    *outSize = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* frame = static_cast<unsigned char*>(malloc(*outSize ? *outSize : 1));
+    if (fread(frame, 1, *outSize, f) != *outSize) {
+        fprintf(stderr, "bench: can't read %s\n", out);
+        exit(1);
+    }
+    fclose(f);
+    unlink(out);
+    return frame;
+}
+
+// Empty, text like, repetitive and incompressible inputs, the last two span several 64 KiB blocks
+static void lz4_input(unsigned char* out, size_t size, int kind) {
+    static const char words[] = "the quick brown fox jumps over the lazy dog sphynx ramfs welcome ";
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        if (kind == 0) {
+            out[i] = words[(i + (seed >> 60)) % (sizeof(words) - 1)];
+        } else if (kind == 1) {
+            out[i] = static_cast<unsigned char>(i % 7);
+        } else {
+            out[i] = static_cast<unsigned char>(seed >> 56);
+        }
+    }
+}
+
+static void bench_lz4() {
+    const char* tool = getenv("LZ4") ? getenv("LZ4") : "lz4";
+    static const struct { const char* name; size_t size; int kind; } inputs[] = {
+        { "empty", 0, 0 },
+        { "text", 4096, 0 },
+        { "text", 300000, 0 },
+        { "repeat", 200000, 1 },
+        { "random", 150000, 2 },
+    };
+    const size_t maxSize = 300000;
+    unsigned char* input = static_cast<unsigned char*>(malloc(maxSize));
+    unsigned char* output = static_cast<unsigned char*>(malloc(maxSize + 1));
+
+    for (auto& in : inputs) {
+        lz4_input(input, in.size, in.kind);
+        for (auto& mode : lz4Modes) {
+            size_t frameSize;
+            unsigned char* frame = lz4_compress(tool, mode.flags, input, in.size, &frameSize);
+            if (!frame) {
+                printf("bench: %s not usable, skipping the lz4 suite\n", tool);
+                free(input);
+                free(output);
+                return;
+            }
+
+            // One spare byte of capacity catches a decoder that writes past the content
+            int64_t decoded = lz4_frame_decode(frame, frameSize, output, maxSize + 1);
+            if (decoded != static_cast<int64_t>(in.size) || memcmp(output, input, in.size) != 0) {
+                fprintf(stderr, "bench: lz4 %s %s %zu decoded to %lld bytes\n", mode.name, in.name, in.size, static_cast<long long>(decoded));
+                exit(1);
+            }
+            // The paged decoder must agree, small pages make matches and literals straddle page boundaries
+            static const size_t pageSizes[] = { 64, 4096 };
+            for (size_t pageSize : pageSizes) {
+                size_t pageCount = in.size / pageSize + 1;
+                uint8_t** pages = static_cast<uint8_t**>(malloc(pageCount * sizeof(uint8_t*)));
+                for (size_t i = 0; i < pageCount; i++) {
+                    pages[i] = output + i * pageSize;
+                }
+                memset(output, 0, maxSize + 1);
+                decoded = lz4_frame_decode_pages(frame, frameSize, pages, pageSize, in.size);
+                if (decoded != static_cast<int64_t>(in.size) || memcmp(output, input, in.size) != 0) {
+                    fprintf(stderr, "bench: lz4 %s %s %zu paged by %zu decoded to %lld bytes\n", mode.name, in.name, in.size, pageSize, static_cast<long long>(decoded));
+                    exit(1);
+                }
+                free(pages);
+            }
+
+            uint64_t contentSize;
+            bool hasSize = lz4_frame_content_size(frame, frameSize, &contentSize);
+            // Empty frames report a zero size even when the encoder left it out
+            bool wantSize = in.size == 0 || strstr(mode.flags, "content-size");
+            if (hasSize != wantSize || (hasSize && contentSize != in.size)) {
+                fprintf(stderr, "bench: lz4 %s %s content size is wrong\n", mode.name, in.name);
+                exit(1);
+            }
+            // Too small a buffer and a frame cut short must both fail instead of overrunning
+            if (in.size && lz4_frame_decode(frame, frameSize, output, in.size - 1) >= 0) {
+                fprintf(stderr, "bench: lz4 %s %s overran its buffer\n", mode.name, in.name);
+                exit(1);
+            }
+            if (lz4_frame_decode(frame, frameSize - 1, output, maxSize + 1) >= 0) {
+                fprintf(stderr, "bench: lz4 %s %s accepted a truncated frame\n", mode.name, in.name);
+                exit(1);
+            }
+
+            if (in.size && strcmp(mode.name, "default") == 0) {
+                volatile int64_t sink = 0;
+                record("lz4", "decode", "sphynx", in.size, in.name, measure([&] { sink = lz4_frame_decode(frame, frameSize, output, maxSize + 1); }), in.size);
+                uint8_t* pages[maxSize / 4096 + 1];
+                for (size_t i = 0; i <= maxSize / 4096; i++) {
+                    pages[i] = output + i * 4096;
+                }
+                record("lz4", "decode_pages", "sphynx", in.size, in.name, measure([&] { sink = lz4_frame_decode_pages(frame, frameSize, pages, 4096, in.size); }), in.size);
+                (void)sink;
+            }
+            free(frame);
+        }
+    }
+    free(input);
+    free(output);
+}
+
+static void write_csv(FILE* out) {
+    fprintf(out, "suite,function,impl,size,align,ns_per_call,gb_per_s\n");
+    for (size_t i = 0; i < resultCount; i++) {
+        result_t* r = &results[i];
+        fprintf(out, "%s,%s,%s,%zu,%s,%.3f,%.3f\n", r->suite, r->function, r->impl, r->size, r->align, r->nsPerCall, r->gbPerSec);
+    }
+}
+
+static void write_json(FILE* out) {
+    fprintf(out, "[\n");
+    for (size_t i = 0; i < resultCount; i++) {
+        result_t* r = &results[i];
+        fprintf(out, "  {\"suite\": \"%s\", \"function\": \"%s\", \"impl\": \"%s\", \"size\": %zu, \"align\": \"%s\", "
+            "\"ns_per_call\": %.3f, \"gb_per_s\": %.3f}%s\n", r->suite, r->function, r->impl, r->size, r->align,
+            r->nsPerCall, r->gbPerSec, i + 1 == resultCount ? "" : ",");
+    }
+    fprintf(out, "]\n");
+}
+
+// Side by side view of the kernel against glibc for the same case
+static void print_summary() {
+    printf("%-8s %-16s %8s %5s %12s %12s %8s\n", "suite", "function", "size", "align", "sphynx ns", "glibc ns", "ratio");
+    for (size_t i = 0; i < resultCount; i++) {
+        result_t* r = &results[i];
+        if (strcmp(r->impl, "sphynx") != 0) {
+            continue;
+        }
+        const result_t* ref = nullptr;
+        for (size_t j = 0; j < resultCount; j++) {
+            result_t* o = &results[j];
+            if (strcmp(o->impl, "glibc") == 0 && strcmp(o->function, r->function) == 0 && o->size == r->size && strcmp(o->align, r->align) == 0) {
+                ref = o;
+                break;
+            }
+        }
+        if (ref) {
+            printf("%-8s %-16s %8zu %5s %12.1f %12.1f %7.2fx\n", r->suite, r->function, r->size, r->align, r->nsPerCall, ref->nsPerCall, r->nsPerCall / ref->nsPerCall);
+        } else {
+            printf("%-8s %-16s %8zu %5s %12.1f %12s %8s\n", r->suite, r->function, r->size, r->align, r->nsPerCall, "-", "-");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* csvPath = nullptr;
+    const char* jsonPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csvPath = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            minSampleNs = 2e6;
+        } else {
+            fprintf(stderr, "usage: %s [--csv file] [--json file] [--quick]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    string_init();
+    printf("sphynx memcpy variant: %s\n", string_get_variant());
+
+    // Room for the largest case plus offsets and the overlapping memmove
+    size_t bufferSize = 2 * 1048576 + 4096;
+    bufA = static_cast<unsigned char*>(aligned_alloc(4096, bufferSize));
+    bufB = static_cast<unsigned char*>(aligned_alloc(4096, bufferSize));
+    memset(bufA, 1, bufferSize);
+    memset(bufB, 2, bufferSize);
+
+    bench_memory();
+    bench_strings();
+    bench_tar();
+    bench_lz4();
+    print_summary();
+
+    if (csvPath) {
+        FILE* out = fopen(csvPath, "w");
+        if (!out) {
+            perror(csvPath);
+            return 1;
+        }
+        write_csv(out);
+        fclose(out);
+    }
+    if (jsonPath) {
+        FILE* out = fopen(jsonPath, "w");
+        if (!out) {
+            perror(jsonPath);
+            return 1;
+        }
+        write_json(out);
+        fclose(out);
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+#!/usr/bin/env python3
+# Compares two benchmark CSVs and lists the cases whose time changed by more than the threshold
+import csv
+import sys
+
+
+def load(path):
+    with open(path, newline="") as f:
+        return {(r["suite"], r["function"], r["impl"], r["size"], r["align"]): float(r["ns_per_call"]) for r in csv.DictReader(f)}
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(f"usage: {sys.argv[0]} old.csv new.csv [threshold, default 0.05]")
+        return 1
+
+    old = load(sys.argv[1])
+    new = load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 0.05
+
+    changed = 0
+    for key in sorted(old.keys() & new.keys()):
+        ratio = new[key] / old[key] if old[key] else 1.0
+        if abs(ratio - 1.0) >= threshold:
+            changed += 1
+            print(f"{'/'.join(key):48} {old[key]:12.1f} -> {new[key]:12.1f} ns  {ratio:6.2f}x {'slower' if ratio > 1 else 'faster'}")
+
+    for key in sorted(old.keys() - new.keys()):
+        print(f"{'/'.join(key):48} removed")
+    for key in sorted(new.keys() - old.keys()):
+        print(f"{'/'.join(key):48} added")
+
+    print(f"{changed} of {len(old.keys() & new.keys())} cases changed by at least {threshold:.0%}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,47 @@
+/*
+Sphynx Operating System
+
+File: pmm.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Hosted stand-in for the page allocator, used by the benchmarks
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define PAGE_SIZE 0x1000
+
+namespace PMM {
+    // Physical addresses are host pointers, see the VMM shim
+    static inline void* request_pages(uint64_t page_count) {
+        return aligned_alloc(PAGE_SIZE, page_count * PAGE_SIZE);
+    }
+
+    static inline void free_pages(void* ptr) {
+        free(ptr);
+    }
+}
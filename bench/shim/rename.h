@@ -0,0 +1,45 @@
+/*
+Sphynx Operating System
+
+File: rename.h
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Gives the kernel's libc symbols a sphynx_ prefix so they can sit next to glibc
+*/
+
+#pragma once
+
+#define memset sphynx_memset
+#define memcpy sphynx_memcpy
+#define memmove sphynx_memmove
+#define memcmp sphynx_memcmp
+#define strlen sphynx_strlen
+#define strcmp sphynx_strcmp
+#define strncmp sphynx_strncmp
+#define strcpy sphynx_strcpy
+#define strcat sphynx_strcat
+#define strncpy sphynx_strncpy
+#define strchr sphynx_strchr
+#define strrchr sphynx_strrchr
+#define strstr sphynx_strstr
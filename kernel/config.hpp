@@ -35,4 +35,17 @@ Description: Sphynx config file
 #define SPHYNX_DEBUG 1
 #define SPHYNX_SIMPLE_PANIC 1
 #define SPHYNX_DUMP_REG_ON_INT 0
-#define SPHYNX_VERBOSE_IDT 0
\ No newline at end of file
+#define SPHYNX_VERBOSE_IDT 0
+#define SPHYNX_PMM_SELF_TEST 0
+#define SPHYNX_MAX_CPUS 32
+#define SPHYNX_ALLOC_PROFILE 0
+#define SPHYNX_STRING_SELF_TEST 0
+#define SPHYNX_RAMFS_CACHE_PAGES 2048
+#define SPHYNX_VFS_SELF_TEST 0
+#define SPHYNX_LOG_RING_SIZE 65536
+#define SPHYNX_LOG_DEFERRED 1
+#define SPHYNX_TRACE 0
+#define SPHYNX_TRACE_ENTRIES 4096
+#define SPHYNX_FB_BACK_BUFFER 1
+#define SPHYNX_FB_FLUSH_US 16000
+#define SPHYNX_FB_FILL_TEST 0
\ No newline at end of file
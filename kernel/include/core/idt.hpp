@@ -79,6 +79,11 @@ namespace IDT {
         uint64_t ss;
     } __packed int_frame_t;
 
+    // Runs with interrupts off, the EOI is sent once it returns
+    typedef void (*irq_handler_t)(uint8_t irq, void* ctx);
+
     void init();
     void capture_regs(int_frame_t *context);
+    // One handler per line, the line is unmasked by whoever registers it
+    bool register_irq(uint8_t irq, irq_handler_t handler, void* ctx);
 }
\ No newline at end of file
@@ -0,0 +1,57 @@
+/*
+Sphynx Operating System
+
+File: early.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Early boot memory map sanitizer and bump allocator
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+
+namespace Early {
+    typedef struct {
+        uint64_t base;
+        uint64_t end;
+        uint64_t type;
+    } range_t;
+
+    // Sorts and de-overlaps the bootloader memory map, then sets up a bump allocator in the largest usable range
+    void init(memory_map_t *memmap);
+    uint64_t get_range_count();
+    const range_t* get_ranges();
+
+    // Zeroed, never freed. Panics when the allocator is exhausted or already retired
+    void* alloc(uint64_t size, uint64_t alignment = 16);
+
+    // Seals the allocator and returns the page aligned range it consumed, that range stays allocated for good
+    void retire(uint64_t* usedBase, uint64_t* usedEnd);
+
+    // Allocation hooks for flanterm, frees are ignored
+    void* flanterm_alloc(size_t size);
+    void flanterm_free(void* ptr, size_t size);
+}
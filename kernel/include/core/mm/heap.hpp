@@ -0,0 +1,63 @@
+/*
+Sphynx Operating System
+
+File: heap.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Sphynx kernel heap
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Heap {
+    // Runs once per object when its slab is created, freed objects must be handed back in their constructed state
+    typedef void (*ctor_t)(void* object);
+
+    typedef struct cache cache_t;
+
+    void init();
+    cache_t* cache_create(const char* name, size_t size, size_t align, ctor_t ctor);
+    void* cache_alloc(cache_t* cache);
+    void cache_free(cache_t* cache, void* object);
+    void dump_stats();
+}
+
+// Sizes up to HEAP_MAX_CLASS come from slabs, anything larger gets whole pages
+#define HEAP_MAX_CLASS 4096
+
+void* kmalloc(size_t size);
+void* kcalloc(size_t count, size_t size);
+void kfree(void* ptr);
+
+inline void* operator new(size_t, void* ptr) noexcept {
+    return ptr;
+}
+
+inline void* operator new[](size_t, void* ptr) noexcept {
+    return ptr;
+}
@@ -0,0 +1,64 @@
+/*
+Sphynx Operating System
+
+File: mm_lock.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Locks guarding state the page fault handler needs
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/cpu.hpp>
+#include <sys/percpu.hpp>
+#include <sys/spinlock.hpp>
+
+// Address space and PMM locks, taken by VMM::handle_fault to resolve demand and copy on write faults.
+// Holders run with interrupts off so no handler can fault into a lock its CPU already owns, and each CPU
+// counts the ones it holds so a fault taken from inside the memory manager panics instead of spinning forever
+class MmLock {
+public:
+    void lock() {
+        uint64_t saved = irq_save();
+        inner.lock();
+        flags = saved;
+        PerCPU::current()->mmLocks++;
+    }
+
+    void unlock() {
+        uint64_t saved = flags;
+        PerCPU::current()->mmLocks--;
+        inner.unlock();
+        irq_restore(saved);
+    }
+
+    static bool held_by_this_cpu() {
+        return PerCPU::current()->mmLocks != 0;
+    }
+
+private:
+    Spinlock inner;
+    uint64_t flags = 0;
+};
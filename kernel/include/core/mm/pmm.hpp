@@ -33,9 +33,73 @@ Description: Sphynx physical memory manager
 #include <common.hpp>
 #include <stdint.h>
 
+#define PAGE_SIZE 0x1000
+#define HUGE_PAGE_SIZE 0x200000
+
 namespace PMM {
-    void init(memory_map_t *memmap);
+    // Blocks of 2^0 .. 2^(MAX_ORDER - 1) pages, the largest block is 4 MiB
+    static constexpr uint8_t MAX_ORDER = 11;
+
+    // DMA is below 16 MiB, DMA32 below 4 GiB and Normal is everything above
+    typedef enum {
+        ZONE_DMA,
+        ZONE_DMA32,
+        ZONE_NORMAL,
+        ZONE_COUNT
+    } Zone;
+
+    // Per CPU single page cache statistics
+    typedef struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t refills;
+        uint64_t drains;
+    } cache_stats_t;
+
+    typedef struct {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t idleZeroed;
+        // Pool pages handed back to the buddy allocator because an allocation ran dry
+        uint64_t reclaimed;
+        uint64_t poolPages;
+    } zero_stats_t;
+
+    // Frees up to pages pages held by a cache built on the PMM and returns how many it freed. Runs when an
+    // allocation is about to fail, with no PMM lock held but possibly inside that cache's own allocation
+    typedef uint64_t (*shrinker_t)(uint64_t pages);
+
+    // Takes over from the early allocator, everything it handed out stays allocated
+    void init();
+    // Free physical memory in bytes
     uint64_t get_free();
+    // Allocates a contiguous block of page_count pages, rounded up to the next power of two
     void* request_pages(uint64_t page_count);
+    // Allocates from zone or any zone below it, e.g. ZONE_DMA32 for devices limited to 32 bit addresses
+    void* request_pages_zone(uint64_t page_count, Zone zone);
+    // Allocates a block aligned to alignment bytes, which must be a power of two
+    void* request_pages_aligned(uint64_t page_count, uint64_t alignment);
+    // Allocates a naturally aligned 2 MiB frame
+    void* request_huge_page();
+    // Like request_pages but the memory is zeroed, single pages come from the pre-zeroed pool when possible
+    void* request_zeroed_pages(uint64_t page_count);
     void free_pages(void* ptr);
+    // Page sharing, page_put frees the page once the last reference is gone and returns true when it did
+    void page_get(void* page);
+    bool page_put(void* page);
+    uint64_t page_count(void* page);
+    // Back pointer for allocators layered on top, ptr may point anywhere inside the page. Pages past the end have none
+    void set_page_owner(void* page, void* owner);
+    void* get_page_owner(void* ptr);
+    // Moves up to budget free pages into the pre-zeroed pool, returns how many were zeroed. Called from the idle loop,
+    // the pool is given back whenever an allocation would otherwise fail
+    uint64_t zero_idle(uint64_t budget);
+    zero_stats_t get_zero_stats();
+    // Returns false once every slot is taken
+    bool register_shrinker(shrinker_t shrinker);
+    // Free bytes in a zone, pages held in the per CPU caches are not included
+    uint64_t get_free_zone(Zone zone);
+    void dump_zones();
+    cache_stats_t get_cache_stats(uint32_t cpu);
+    void self_test();
 }
\ No newline at end of file
@@ -0,0 +1,56 @@
+/*
+Sphynx Operating System
+
+File: profile.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Allocation profiler for the heap and PMM
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+
+namespace AllocProfile {
+    enum Source {
+        SOURCE_HEAP,
+        SOURCE_PMM,
+        SOURCE_COUNT
+    };
+
+    // Recording an address that is already live moves it to the new site, so wrappers attribute to their caller
+    void record_alloc(void* site, void* ptr, uint64_t size, Source source);
+    void record_free(void* ptr, Source source);
+    // Prints the call sites holding the most live bytes over the 0xE9 debug console
+    void report(uint32_t count);
+}
+
+#if SPHYNX_ALLOC_PROFILE
+#define ALLOC_PROFILE_ALLOC(ptr, size, source) AllocProfile::record_alloc(__builtin_return_address(0), ptr, size, source)
+#define ALLOC_PROFILE_FREE(ptr, source) AllocProfile::record_free(ptr, source)
+#else
+#define ALLOC_PROFILE_ALLOC(ptr, size, source) do {} while (0)
+#define ALLOC_PROFILE_FREE(ptr, source) do {} while (0)
+#endif
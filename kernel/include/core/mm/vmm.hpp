@@ -0,0 +1,124 @@
+/*
+Sphynx Operating System
+
+File: vmm.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Sphynx virtual memory manager
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+#include <core/mm/mm_lock.hpp>
+#include <sys/memtype.hpp>
+
+#define HHDM_OFFSET 0xFFFF800000000000ull
+
+#define PTE_PRESENT (1ull << 0)
+#define PTE_WRITABLE (1ull << 1)
+#define PTE_USER (1ull << 2)
+#define PTE_PWT (1ull << 3)
+#define PTE_PCD (1ull << 4)
+#define PTE_ACCESSED (1ull << 5)
+#define PTE_DIRTY (1ull << 6)
+#define PTE_HUGE (1ull << 7)
+#define PTE_PAT_4K (1ull << 7)
+#define PTE_GLOBAL (1ull << 8)
+// Software bits, COW marks a shared page that gets copied on write, OWNED a frame the VMM allocated and refcounts
+#define PTE_COW (1ull << 9)
+#define PTE_OWNED (1ull << 10)
+#define PTE_PAT_HUGE (1ull << 12)
+#define PTE_NX (1ull << 63)
+#define PTE_ADDR_MASK 0x000FFFFFFFFFF000ull
+
+#define VMM_MAX_REGIONS 64
+
+namespace VMM {
+    // Anonymous memory that is only backed once it is touched
+    typedef struct {
+        uint64_t base;
+        uint64_t end;
+        uint64_t flags;
+    } region_t;
+
+    typedef struct {
+        uint64_t minor;
+        uint64_t cow;
+        uint64_t fatal;
+    } fault_stats_t;
+
+    typedef struct {
+        MmLock lock;
+        uint64_t pml4;
+        uint16_t pcid;
+        // PCID generation the pcid belongs to, a stale generation means a fresh pcid and a full flush
+        uint64_t generation;
+        // Set when a mapping changed while the space wasn't loaded, its tagged TLB entries can't be trusted
+        bool tlbStale;
+        uint64_t regionCount;
+        region_t regions[VMM_MAX_REGIONS];
+    } address_space_t;
+
+    // Builds the kernel page tables and switches to them
+    void init();
+    address_space_t* kernel_space();
+
+    address_space_t* create_space();
+    void destroy_space(address_space_t* space);
+    void switch_to(address_space_t* space);
+    // Duplicates a space, private pages are shared read-only and copied on the first write
+    address_space_t* clone(address_space_t* space);
+
+    // flags are PTE_* bits, PTE_PRESENT is implied
+    bool map(address_space_t* space, uint64_t virt, uint64_t phys, uint64_t flags);
+    // Maps a range with 1 GiB and 2 MiB pages wherever the alignment of both addresses allows
+    bool map_range(address_space_t* space, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags);
+    // map_range with the caching bits of flags replaced by the ones selecting type, for device memory like framebuffers
+    bool map_phys(address_space_t* space, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags, MemType::Type type);
+    void unmap(address_space_t* space, uint64_t virt);
+    bool protect(address_space_t* space, uint64_t virt, uint64_t flags);
+    // Returns the physical address virt maps to, or 0 when it isn't mapped
+    uint64_t translate(address_space_t* space, uint64_t virt);
+    // Whether virt falls in a PML4 slot space shares with the kernel, map and unmap refuse those
+    bool is_shared(address_space_t* space, uint64_t virt);
+
+    // Reserves a lazily backed region, pages are allocated zeroed on first touch with the given PTE flags
+    bool reserve(address_space_t* space, uint64_t virt, uint64_t size, uint64_t flags);
+    // Drops the region starting at virt along with every page faulted into it
+    void release(address_space_t* space, uint64_t virt);
+
+    // Resolves demand and copy-on-write faults, returns false when the fault is fatal
+    bool handle_fault(uint64_t addr, uint64_t err);
+    fault_stats_t get_fault_stats();
+
+    static inline void* phys_to_virt(uint64_t phys) {
+        return reinterpret_cast<void*>(phys + HHDM_OFFSET);
+    }
+
+    static inline uint64_t virt_to_phys(const void* virt) {
+        return reinterpret_cast<uint64_t>(virt) - HHDM_OFFSET;
+    }
+}
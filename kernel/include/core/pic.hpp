@@ -0,0 +1,49 @@
+/*
+Sphynx Operating System
+
+File: pic.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: 8259 programmable interrupt controller
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+
+#define PIC_VECTOR_BASE 0x20
+#define PIC_IRQ_COUNT 16
+
+namespace PIC {
+    // Moves IRQ 0-15 to vectors 0x20-0x2F, away from the exceptions, and masks every line
+    void init();
+    void mask(uint8_t irq);
+    void unmask(uint8_t irq);
+
+    // IRQ 7 and 15 also show up when a request goes away before it is acknowledged. A spurious one gets no EOI,
+    // except that a spurious IRQ 15 still passed through the master
+    bool is_spurious(uint8_t irq);
+    void eoi(uint8_t irq);
+}
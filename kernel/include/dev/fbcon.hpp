@@ -0,0 +1,58 @@
+/*
+Sphynx Operating System
+
+File: fbcon.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Framebuffer console rendered into a RAM back buffer
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace FBCon {
+    typedef struct {
+        uint64_t renderNs;
+        uint64_t flushNs;
+        uint64_t flushes;
+        uint64_t bytesFlushed;
+    } stats_t;
+
+    // Creates flanterm drawing into a RAM copy of fb, or straight into fb when SPHYNX_FB_BACK_BUFFER is off
+    struct flanterm_context* init(struct framebuffer* fb, uint32_t defaultBg, uint32_t defaultFg);
+    bool is_buffered();
+
+    // Renders into the back buffer, dirty cells reach the screen once SPHYNX_FB_FLUSH_US has passed since the last flush
+    void write(struct flanterm_context* ctx, const char* buffer, size_t length);
+    // Copies every dirty span to the framebuffer now
+    void flush();
+
+    stats_t get_stats();
+
+    // Times a few whole screen fills of video memory and returns MiB/s, then redraws the console
+    uint64_t measure_fill_rate();
+}
@@ -0,0 +1,64 @@
+/*
+Sphynx Operating System
+
+File: klog.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Per CPU kernel log ring with deferred console output
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+// Longest message a single record holds, longer ones are truncated
+#define KLOG_LINE_MAX 1024
+
+namespace KLog {
+    typedef struct {
+        uint64_t records;
+        uint64_t dropped;
+        uint64_t flushes;
+    } stats_t;
+
+    // Sets up the ring of the calling CPU, records logged before a CPU has a ring go straight to the console
+    void init_cpu();
+
+    // Formats the message into the calling CPU's ring without taking locks, safe from interrupt context.
+    // level is a Logger::Level, name the logger name. Records that don't fit are dropped and counted.
+    // Records keep the raw TSC and are timed when printed, so anything still in a ring at TSC::init gets a real
+    // timestamp. Records printed before calibration, e.g. the ones logged before init_cpu, show 0
+    void write(int level, const char* name, const char* fmt, va_list args);
+    // Drains every ring to the console in timestamp order, returns right away when another CPU is draining
+    void flush();
+    // True while any ring holds records, lets the idle loop check for work with interrupts off
+    bool pending();
+    // Takes over the rings regardless of who holds them and drains them, later records bypass the rings
+    void panic_flush();
+
+    stats_t get_stats();
+}
@@ -31,8 +31,13 @@ Description: Sphynx serial I/O manager
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <common.hpp>
 
+// Ring sizes in bytes, powers of two
+#define SERIAL_TX_RING 16384
+#define SERIAL_RX_RING 1024
+
 namespace Serial {
 	// Common ports
 	typedef enum {
@@ -59,22 +64,61 @@ namespace Serial {
 
 	static constexpr uint8_t ERROR_FAILED_TO_INIT = 0x01; 
 
+	typedef struct {
+		uint64_t txBytes;
+		uint64_t rxBytes;
+		// Bytes that found the TX ring full
+		uint64_t txDropped;
+		// Bytes that arrived while the RX ring was full
+		uint64_t rxDropped;
+		// Bytes lost in the UART itself because its receive FIFO wasn't emptied in time
+		uint64_t overruns;
+		uint64_t interrupts;
+	} stats_t;
+
 	class Stream {
 	public:
 		Stream(COM_PORTS port);
+		// Polled, these spin on the line status register
 		uint8_t read();
 		void write(uint8_t data);
 		bool has_error();
 		char* error_to_str();
-		
+
+		// Hooks the port up to irq and switches it to interrupt driven transfers through the rings
+		bool enable_irq(uint8_t irq);
+		// Queues as much of buffer as fits and returns without waiting, the rest is counted as dropped.
+		// Before enable_irq or with interrupts off, like during a panic, it polls the bytes out instead
+		size_t write(const char* buffer, size_t length);
+		// Takes whatever has been received, never waits
+		size_t read(char* buffer, size_t length);
+		stats_t get_stats();
+
 	private:
 		bool serial_recived();
 		bool is_transmit_empty();
+		bool pump_tx(bool poll);
+		void receive();
+		static void irq_handler(uint8_t irq, void* ctx);
 
 	private:
 		COM_PORTS port;
 		bool is_error;
 		uint8_t error;
+
+		bool irqMode;
+		// TX has many producers: a writer reserves a range of txReserve, fills it and publishes it through txCommit
+		// in reservation order. Only the holder of txBusy consumes
+		uint64_t txReserve;
+		uint64_t txCommit;
+		uint64_t txTail;
+		bool txBusy;
+		// RX is filled by the interrupt handler alone and drained by one reader
+		uint64_t rxHead;
+		uint64_t rxTail;
+		stats_t stats;
+		char txRing[SERIAL_TX_RING];
+		char rxRing[SERIAL_RX_RING];
 	};
 
 	void outb(uint16_t port, uint8_t value);
@@ -32,17 +32,53 @@ Description: Sphynx TTY system
 
 #include <common.hpp>
 #include <stdarg.h>
+#include <stddef.h>
+#include <dev/klog.hpp>
+#include <dev/serial.hpp>
+#include <stdint.h>
+
+#define CONSOLE_MAX_SINKS 8
+// Level of plain printf output, it isn't a log record so every sink filter lets it through
+#define CONSOLE_LEVEL_RAW 0x7F
+
+namespace Console {
+    enum SinkKind {
+        SINK_SCREEN = 1 << 0,
+        SINK_DEBUG = 1 << 1,
+        SINK_ALL = SINK_SCREEN | SINK_DEBUG,
+    };
+
+    // Where printf and log records end up
+    static constexpr uint32_t SINK_PRINTF = SPHYNX_MIRROR_PRINTF ? SINK_ALL : SINK_SCREEN;
+
+    typedef void (*sink_write_t)(void* ctx, const char* buffer, size_t length);
+    // Optional, for sinks that hold output back, pushes it out
+    typedef void (*sink_flush_t)(void* ctx);
+
+    // The framebuffer ("fb") and the 0xE9 debug port ("e9") are registered from the start.
+    // A sink receives writes aimed at one of its kinds with a level of at least its own, levels are Logger::Level
+    bool add_sink(const char* name, uint32_t kind, sink_write_t write, void* ctx, int level, sink_flush_t flush = nullptr);
+    bool set_level(const char* name, int level);
+    // Probes a 16550 at port and registers it as a debug sink named "uart". It polls until its IRQ is enabled
+    bool add_uart(uint16_t port, int level);
+    Serial::Stream* get_uart();
+
+    // Hands the buffer to each matching sink in one piece
+    void write(uint32_t kinds, int level, const char* buffer, size_t length);
+    // Formats once and streams the result to the sinks in chunks, so output has no length limit
+    int vprint(uint32_t kinds, int level, const char* fmt, va_list args);
+    // Makes everything written so far visible, the framebuffer sink batches its updates
+    void flush();
+}
 
 int kprintf(const char* fmt, ...);
 int kdprintf(const char* fmt, ...);
+// Screen and debug sinks at once, formatted a single time
+int kmprintf(const char* fmt, ...);
 
 void vprintf(const char* fmt, va_list args);
 
-#define KMPRINTF(fmt, ...) \
-    do { \
-        kprintf(fmt, ##__VA_ARGS__); \
-        kdprintf(fmt, ##__VA_ARGS__); \
-    } while (0)
+#define KMPRINTF(fmt, ...) kmprintf(fmt, ##__VA_ARGS__)
 
 #if SPHYNX_MIRROR_PRINTF
 #define printf(fmt, ...) KMPRINTF(fmt, ##__VA_ARGS__)
@@ -72,79 +108,55 @@ public:
         level = lvl;
     }
 
+    // Records go to the per CPU log ring and reach the console when it is flushed
     void log(Level lvl, const char* fmt, ...) const {
-        if (lvl < level) return;
-
-        const char* color = get_color(lvl);
-        const char* kind = get_kind(lvl);
-        printf("%s[%-6s] [%-10s] ", color, kind, name);
-
         va_list args;
         va_start(args, fmt);
-        vprintf(fmt, args);
+        vlog(lvl, fmt, args);
         va_end(args);
+    }
 
-        printf("\033[0m");
+    void vlog(Level lvl, const char* fmt, va_list args) const {
+        if (lvl < level) return;
+        KLog::write(lvl, name, fmt, args);
     }
 
     void info(const char* fmt, ...) const {
         va_list args;
         va_start(args, fmt);
-        log(INFO, fmt, args);
+        vlog(INFO, fmt, args);
         va_end(args);
     }
 
     void ok(const char* fmt, ...) const {
         va_list args;
         va_start(args, fmt);
-        log(OK, fmt, args);
+        vlog(OK, fmt, args);
         va_end(args);
     }
 
     void warn(const char* fmt, ...) const {
         va_list args;
         va_start(args, fmt);
-        log(WARN, fmt, args);
+        vlog(WARN, fmt, args);
         va_end(args);
     }
 
     void error(const char* fmt, ...) const {
         va_list args;
         va_start(args, fmt);
-        log(ERROR, fmt, args);
+        vlog(ERROR, fmt, args);
         va_end(args);
     }
 
     void debug(const char* fmt, ...) const {
         va_list args;
         va_start(args, fmt);
-        log(DEBUG, fmt, args);
+        vlog(DEBUG, fmt, args);
         va_end(args);
     }
 
 private:
     const char* name;
     Level level;
-
-    const char* get_color(Level lvl) const {
-        switch (lvl) {
-            case INFO: return "\x1b[38;2;129;161;193m";
-            case OK: return "\x1b[38;2;163;190;140m";
-            case WARN: return "\x1b[38;2;235;203;139m";
-            case ERROR: return "\x1b[38;2;191;97;106m";
-            case DEBUG: return "\x1b[38;2;94;129;172m";
-            default: return "\033[0m";
-        }
-    }
-
-    const char* get_kind(Level lvl) const {
-        switch (lvl) {
-            case INFO: return "INFO";
-            case OK: return "OK";
-            case WARN: return "WARN";
-            case ERROR: return "ERROR";
-            case DEBUG: return "DEBUG";
-            default: return "UNKNOWN";
-        }
-    }
 };
\ No newline at end of file
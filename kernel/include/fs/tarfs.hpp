@@ -0,0 +1,52 @@
+/*
+Sphynx Operating System
+
+File: tarfs.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Read only file system over the ramfs tar
+*/
+
+#pragma once
+
+#include <fs/vfs.hpp>
+
+namespace Tarfs {
+    typedef struct {
+        uint64_t hits;
+        uint64_t decompressions;
+        uint64_t evictions;
+        uint64_t corrupt;
+        uint64_t cachedPages;
+    } cache_stats_t;
+
+    // Indexes the archive and returns its root directory, or nullptr when out of memory.
+    // Compressed entries are decoded on first read into single pages of a cache shared by all mounts,
+    // capped at SPHYNX_RAMFS_CACHE_PAGES including each entry's page array and evicted least recently used first
+    VFS::vnode_t* create(const void* buffer, size_t size);
+    // Drops cached contents until at least pages are freed or the cache is empty, returns the pages freed.
+    // Registered as a PMM shrinker, returns 0 when called from inside a read that is filling the cache
+    uint64_t shrink(uint64_t pages);
+    cache_stats_t get_cache_stats();
+}
@@ -0,0 +1,140 @@
+/*
+Sphynx Operating System
+
+File: vfs.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Sphynx virtual file system
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+#include <stddef.h>
+#include <core/mm/vmm.hpp>
+
+// Errors are returned negated, e.g. -VFS_ENOENT
+#define VFS_ENOENT 2
+#define VFS_EIO 5
+#define VFS_EBADF 9
+#define VFS_ENOMEM 12
+#define VFS_EBUSY 16
+#define VFS_EEXIST 17
+#define VFS_ENOTDIR 20
+#define VFS_EISDIR 21
+#define VFS_EINVAL 22
+#define VFS_EMFILE 24
+#define VFS_ENOTSUP 95
+
+#define VFS_MAX_FILES 64
+#define VFS_NAME_MAX 255
+
+#define VFS_SEEK_SET 0
+#define VFS_SEEK_CUR 1
+#define VFS_SEEK_END 2
+
+namespace VFS {
+    enum VnodeType {
+        VNODE_FILE,
+        VNODE_DIR,
+    };
+
+    struct vnode;
+
+    typedef struct {
+        char name[VFS_NAME_MAX + 1];
+        VnodeType type;
+        uint64_t size;
+    } dirent_t;
+
+    typedef struct {
+        VnodeType type;
+        uint64_t size;
+    } stat_t;
+
+    // Backend hooks, any of them may be null when the backend doesn't support the operation
+    typedef struct {
+        // Sets *out to a new reference on the child, -VFS_ENOENT lets the VFS cache a negative entry
+        int (*lookup)(struct vnode* dir, const char* name, size_t length, struct vnode** out);
+        int64_t (*read)(struct vnode* node, uint64_t offset, void* buffer, uint64_t length);
+        // cookie is 0 for the first entry and updated to resume after the returned one, returns 0 at the end
+        int (*readdir)(struct vnode* dir, uint64_t* cookie, dirent_t* out);
+        // Frees backend state once the last reference is dropped
+        void (*release)(struct vnode* node);
+        // Physical address of the whole page at the page aligned offset when the backend keeps it in memory for as
+        // long as it is mounted, -VFS_ENOTSUP makes the VFS copy that page instead
+        int (*map_page)(struct vnode* node, uint64_t offset, uint64_t* phys);
+    } vnode_ops_t;
+
+    typedef struct vnode {
+        VnodeType type;
+        uint64_t size;
+        uint32_t refs;
+        const vnode_ops_t* ops;
+        void* data;
+    } vnode_t;
+
+    typedef struct {
+        uint64_t hits;
+        uint64_t negativeHits;
+        uint64_t misses;
+        uint64_t backendLookups;
+        uint64_t evictions;
+        uint64_t entries;
+    } dcache_stats_t;
+
+    typedef struct {
+        uint64_t sharedPages;
+        uint64_t copiedPages;
+    } map_stats_t;
+
+    void init();
+    // Backends hand out vnodes with refs set to 1, the VFS owns that reference afterwards
+    vnode_t* vnode_create(VnodeType type, uint64_t size, const vnode_ops_t* ops, void* data);
+    void vnode_get(vnode_t* node);
+    void vnode_put(vnode_t* node);
+
+    // Mounts root over the directory at path, "/" mounts the root file system
+    int mount(const char* path, vnode_t* root);
+
+    int open(const char* path);
+    int64_t read(int fd, void* buffer, uint64_t length);
+    int64_t seek(int fd, int64_t offset, int whence);
+    // Returns 1 with an entry, 0 at the end of the directory
+    int readdir(int fd, dirent_t* out);
+    int close(int fd);
+    int stat(const char* path, stat_t* out);
+    // Maps length bytes of the file from offset read-only at virt, both page aligned. Pages the backend holds in
+    // memory are mapped in place, the rest are copied into fresh pages zeroed past the end of the file.
+    // flags are extra PTE_* bits, writable mappings are refused and so is a range that is already partly mapped
+    int mmap(int fd, VMM::address_space_t* space, uint64_t virt, uint64_t length, uint64_t offset, uint64_t flags);
+    // Unmaps a range set up by mmap, copied pages are freed and shared ones are left to their backend
+    void munmap(VMM::address_space_t* space, uint64_t virt, uint64_t length);
+
+    dcache_stats_t get_dcache_stats();
+    map_stats_t get_map_stats();
+    // Maps the file at path into a scratch address space and checks the pages against read, panics on a mismatch
+    void self_test(const char* path);
+}
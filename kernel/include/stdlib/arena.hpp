@@ -0,0 +1,126 @@
+/*
+Sphynx Operating System
+
+File: arena.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Chunked arena allocator
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Chunks are allocated in whole pages, requests larger than a chunk get a chunk of their own
+#define ARENA_DEFAULT_CHUNK 0x4000
+
+// Bump allocator for objects that die together, nothing is freed individually
+class Arena {
+public:
+    struct chunk_t;
+
+    typedef struct {
+        chunk_t* chunk;
+        size_t used;
+        // Lets rewind tell a savepoint whose chunk was dropped or recycled since it was taken
+        uint64_t serial;
+        uint64_t generation;
+    } savepoint_t;
+
+    explicit Arena(size_t chunkSize = ARENA_DEFAULT_CHUNK);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Returns nullptr when out of memory or alignment is above PAGE_SIZE, alignment must be a power of two
+    void* alloc(size_t size, size_t alignment = 16);
+    // Gives back the most recent allocation, used by containers growing in place
+    bool shrink_last(void* ptr, size_t size);
+
+    template <typename T>
+    T* alloc_array(size_t count) {
+        return static_cast<T*>(alloc(count * sizeof(T), alignof(T)));
+    }
+
+    // Everything allocated after save() is dropped by rewind(), savepoints nest like a stack.
+    // Rewinding to a savepoint taken before a reset() or release(), or whose chunk a rewind already dropped, does nothing
+    savepoint_t save() const;
+    void rewind(savepoint_t savepoint);
+    // Drops every allocation in O(1) but keeps the chunks for reuse
+    void reset();
+    // Drops every allocation and returns all chunks to the PMM, one free per chunk
+    void release();
+
+    size_t get_used() const;
+    size_t get_reserved() const;
+
+private:
+    bool grow(size_t size, size_t alignment);
+
+    chunk_t* current;
+    // Oldest live chunk, lets reset() splice the whole chain onto the spare list
+    chunk_t* first;
+    chunk_t* spare;
+    size_t chunkSize;
+    size_t reserved;
+    uint64_t nextSerial;
+    uint64_t generation;
+};
+
+// Rewinds the arena when it goes out of scope
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& arena) : arena(arena), savepoint(arena.save()) {}
+    ~ArenaScope() {
+        arena.rewind(savepoint);
+    }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena& arena;
+    Arena::savepoint_t savepoint;
+};
+
+// Container allocator that carves from an arena, e.g. Vector<int, ArenaAllocator<int>>
+template <typename T>
+struct ArenaAllocator {
+    Arena* arena;
+
+    ArenaAllocator() : arena(nullptr) {}
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+
+    T* allocate(size_t count) {
+        return arena ? arena->alloc_array<T>(count) : nullptr;
+    }
+
+    void deallocate(T* ptr, size_t count) {
+        if (arena) {
+            arena->shrink_last(ptr, count * sizeof(T));
+        }
+    }
+};
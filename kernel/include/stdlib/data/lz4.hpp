@@ -0,0 +1,45 @@
+/*
+Sphynx Operating System
+
+File: lz4.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: LZ4 frame decoder
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZ4_FRAME_MAGIC 0x184D2204u
+
+// Content size recorded in the frame header, false when the frame is invalid or was written without one
+bool lz4_frame_content_size(const void* src, size_t srcSize, uint64_t* out);
+// Decodes a whole frame into dst, returns the decoded size or -1 on corrupt input or when dst is too small.
+// Checksums are not verified, the ramfs is trusted boot data
+int64_t lz4_frame_decode(const void* src, size_t srcSize, void* dst, size_t dstCapacity);
+// Same as lz4_frame_decode with the output split over pages of pageSize bytes each, a power of two, so large files
+// don't need one contiguous buffer
+int64_t lz4_frame_decode_pages(const void* src, size_t srcSize, uint8_t* const* pages, size_t pageSize, size_t dstCapacity);
@@ -33,6 +33,7 @@ Description: TAR Parsing library
 #include <stdint.h>
 #include <stddef.h>
 #include <string.hpp>
+#include <arena.hpp>
 
 #define TAR_BLOCK_SIZE 512
 
@@ -63,5 +64,67 @@ struct File {
     int is_directory;
 };
 
+#define TAR_NO_ENTRY 0xFFFFFFFFu
+// pax global header keyword mkramfs sets to "lz4" in compressed images
+#define TAR_PAX_COMPRESSION "SPHYNX.compression"
+
+typedef struct tar_entry {
+    // name is the full normalized path, e.g. "sys/welcome.txt", the root directory is ""
+    File file;
+    uint64_t hash;
+    uint32_t nameLength;
+    // Offset of the last path component within file.name
+    uint32_t baseOffset;
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    // In compressed images "name.lz4" files holding an LZ4 frame are indexed as "name", file.size is then the decompressed size
+    // and file.data points at storedSize bytes of frame
+    uint32_t storedSize;
+    bool compressed;
+} tar_entry_t;
+
+// Path index over a tar archive, built in one pass so lookups don't rescan the archive
+class TarIndex {
+public:
+    TarIndex() = default;
+    ~TarIndex();
+
+    TarIndex(const TarIndex&) = delete;
+    TarIndex& operator=(const TarIndex&) = delete;
+
+    // Returns false when out of memory, parent directories missing from the archive are created implicitly.
+    // Names come from ustar name and prefix fields or GNU 'L' long name records, pax headers are skipped apart from
+    // a global one marking the image as compressed.
+    // Indexing stops at the first entry whose data doesn't fit in the buffer
+    bool build(const void* buffer, size_t size);
+    // Leading "/" or "./" and trailing "/" are ignored
+    const tar_entry_t* lookup(const char* path) const;
+    const tar_entry_t* lookup(const char* path, size_t length) const;
+    // Finds a direct child of dir by name, the building block for component wise path walks
+    const tar_entry_t* lookup_child(const tar_entry_t* dir, const char* name, size_t length) const;
+
+    const tar_entry_t* root() const;
+    const tar_entry_t* first_child(const tar_entry_t* dir) const;
+    const tar_entry_t* next_sibling(const tar_entry_t* entry) const;
+    size_t get_count() const;
+
+private:
+    uint32_t find(const char* path, size_t length, uint64_t hash) const;
+    uint32_t insert(const char* path, size_t length, bool directory);
+    uint32_t ensure_directory(const char* path, size_t length);
+    bool grow_slots();
+    void release();
+
+    tar_entry_t* entries = nullptr;
+    size_t count = 0;
+    size_t capacity = 0;
+    // Open addressed with linear probing, each slot holds an entry index plus one so zero means empty
+    uint32_t* slots = nullptr;
+    size_t slotCount = 0;
+    // Entry names never move once copied, so the pool is an arena dropped whole by release()
+    Arena names;
+};
+
 void list_dir_tar(const void* buffer, size_t size);
 File get_file_tar(const void* buffer, size_t size, const char* path);
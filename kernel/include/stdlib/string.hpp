@@ -37,6 +37,7 @@ extern "C" {
     void* memset(void* d, int c, size_t n);
     void* memcpy(void* dest, const void* src, size_t n);
     void* memmove(void* dest, const void* src, size_t n);
+    int memcmp(const void* s1, const void* s2, size_t n);
     size_t strlen(const char* s);
     int strcmp(const char* s1, const char* s2);
     char* strcpy(char* dest, const char* src);
@@ -47,3 +48,9 @@ extern "C" {
     char* strncpy(char* dest, const char* src, size_t n);
     int strncmp(const char* s1, const char* s2, size_t n);
 }
+
+// Picks memcpy and memset variants from CPUID, portable qword loops are used until this runs
+void string_init();
+const char* string_get_variant();
+// Checks every variant for correctness and logs their throughput per size bucket
+void string_self_test();
@@ -0,0 +1,121 @@
+/*
+Sphynx Operating System
+
+File: vector.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Growable array for kernel code
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <core/mm/heap.hpp>
+#include <string.hpp>
+
+// Default allocator, backed by kmalloc
+template <typename T>
+struct HeapAllocator {
+    T* allocate(size_t count) {
+        return static_cast<T*>(kmalloc(count * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        kfree(ptr);
+    }
+};
+
+template <typename T, typename Allocator = HeapAllocator<T>>
+class Vector {
+public:
+    Vector() = default;
+    explicit Vector(const Allocator& allocator) : alloc(allocator) {}
+
+    Vector(const Vector&) = delete;
+    Vector& operator=(const Vector&) = delete;
+
+    ~Vector() {
+        clear();
+        if (items) {
+            alloc.deallocate(items, cap);
+        }
+    }
+
+    // Returns false when the allocator ran out of memory, the vector is left unchanged
+    bool reserve(size_t count) {
+        if (count <= cap) {
+            return true;
+        }
+        T* grown = alloc.allocate(count);
+        if (!grown) {
+            return false;
+        }
+        for (size_t i = 0; i < len; i++) {
+            new (&grown[i]) T(static_cast<T&&>(items[i]));
+            items[i].~T();
+        }
+        if (items) {
+            alloc.deallocate(items, cap);
+        }
+        items = grown;
+        cap = count;
+        return true;
+    }
+
+    bool push_back(const T& value) {
+        if (len == cap && !reserve(cap ? cap * 2 : 8)) {
+            return false;
+        }
+        new (&items[len++]) T(value);
+        return true;
+    }
+
+    void pop_back() {
+        items[--len].~T();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < len; i++) {
+            items[i].~T();
+        }
+        len = 0;
+    }
+
+    T& operator[](size_t index) { return items[index]; }
+    const T& operator[](size_t index) const { return items[index]; }
+    T* begin() { return items; }
+    T* end() { return items + len; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + len; }
+    size_t size() const { return len; }
+    size_t capacity() const { return cap; }
+    bool empty() const { return len == 0; }
+
+private:
+    T* items = nullptr;
+    size_t len = 0;
+    size_t cap = 0;
+    Allocator alloc;
+};
@@ -33,9 +33,17 @@ Description: Common CPU functions and utilities
 #include <common.hpp>
 #include <core/idt.hpp>
 
+// Sleeps for good, whatever wakes the CPU just sends it back to sleep
 [[noreturn]] static inline void halt() {
-    __asm__ volatile("hlt");
-    while (true) { }
+    for (;;) {
+        __asm__ volatile("hlt");
+    }
+}
+
+// Enables interrupts and sleeps until the next one. sti only takes effect after hlt, so an interrupt arriving in
+// between still wakes the CPU instead of being handled before it goes to sleep
+static inline void wait_for_interrupt() {
+    __asm__ volatile("sti; hlt" : : : "memory");
 }
 
 [[noreturn]] static inline void hcf() {
@@ -43,6 +51,81 @@ Description: Common CPU functions and utilities
     halt();
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+#define DEFINE_CR_ACCESSORS(n) \
+    static inline uint64_t read_cr##n() { \
+        uint64_t value; \
+        __asm__ volatile("mov %%cr" #n ", %0" : "=r"(value)); \
+        return value; \
+    } \
+    static inline void write_cr##n(uint64_t value) { \
+        __asm__ volatile("mov %0, %%cr" #n : : "r"(value) : "memory"); \
+    }
+
+DEFINE_CR_ACCESSORS(0)
+DEFINE_CR_ACCESSORS(3)
+DEFINE_CR_ACCESSORS(4)
+
+// Global pages, toggling it off and on drops every TLB entry
+#define CR4_PGE (1ull << 7)
+
+static inline uint64_t read_cr2() {
+    uint64_t value;
+    __asm__ volatile("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+static inline void invlpg(uint64_t addr) {
+    __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Drops every TLB entry of every PCID, global ones included
+#define INVPCID_ALL_CONTEXTS 2
+
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr) {
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } descriptor = { pcid, addr };
+    __asm__ volatile("invpcid %0, %1" : : "m"(descriptor), "r"(type) : "memory");
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+#define RFLAGS_IF (1ull << 9)
+
+static inline void irq_enable() {
+    __asm__ volatile("sti" : : : "memory");
+}
+
+static inline bool irq_enabled() {
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0" : "=r"(flags));
+    return flags & RFLAGS_IF;
+}
+
+// Disables interrupts and returns the previous RFLAGS for irq_restore
+static inline uint64_t irq_save() {
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    __asm__ volatile("push %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
 void _kpanic_handler(IDT::int_frame_t *frame, const char* file, int line, const char* reason);
 
 #define kpanic(frame, reason) _kpanic_handler(frame, __FILE__, __LINE__, reason)
\ No newline at end of file
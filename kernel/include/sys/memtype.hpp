@@ -0,0 +1,65 @@
+/*
+Sphynx Operating System
+
+File: memtype.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Memory types through the PAT and MTRRs
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+
+#define MSR_MTRR_CAP 0xFE
+#define MSR_MTRR_PHYS_BASE 0x200
+#define MSR_MTRR_PHYS_MASK 0x201
+#define MSR_PAT 0x277
+#define MSR_MTRR_DEF_TYPE 0x2FF
+
+#define CR0_NW (1ull << 29)
+#define CR0_CD (1ull << 30)
+
+namespace MemType {
+    // Encodings shared by the PAT and the MTRRs
+    enum Type : uint8_t {
+        UC = 0,
+        WC = 1,
+        WT = 4,
+        WP = 5,
+        WB = 6,
+        UC_MINUS = 7,
+    };
+
+    // Programs the PAT with WB, WT, UC-, UC in the power on slots and WC, WP after them. Needs to run on every CPU
+    void init();
+    bool has_pat();
+
+    // PTE bits of a 4 KiB mapping selecting type. Without a PAT, WC degrades to UC- and WP to UC
+    uint64_t pte_flags(Type type);
+    // Type the MTRRs give phys, which a WB or WT PAT entry can't improve on
+    Type mtrr_type(uint64_t phys);
+    const char* name(Type type);
+}
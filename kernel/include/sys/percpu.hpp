@@ -0,0 +1,70 @@
+/*
+Sphynx Operating System
+
+File: percpu.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Per CPU data
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+
+#define MSR_GS_BASE 0xC0000101
+
+namespace PerCPU {
+    // GS base points at the current CPU's cpu_t, keep self and id at the front
+    typedef struct cpu {
+        struct cpu* self;
+        uint32_t id;
+        // Extended state of whatever kernel_fpu_begin interrupted, and the nesting depth of FPU sections
+        uint32_t fpuDepth;
+        void* fpuArea;
+        uint64_t fpuFlags;
+        // Interrupt and exception handlers currently running on this CPU
+        uint32_t irqDepth;
+        // MmLocks held by this CPU
+        uint32_t mmLocks;
+    } cpu_t;
+
+    void init_bsp();
+
+    static inline cpu_t* current() {
+        cpu_t* cpu;
+        __asm__ volatile("mov %%gs:0, %0" : "=r"(cpu));
+        return cpu;
+    }
+
+    static inline bool in_interrupt() {
+        return current()->irqDepth != 0;
+    }
+
+    static inline uint32_t id() {
+        uint32_t id;
+        __asm__ volatile("movl %%gs:8, %0" : "=r"(id));
+        return id;
+    }
+}
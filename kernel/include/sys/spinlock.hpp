@@ -0,0 +1,56 @@
+/*
+Sphynx Operating System
+
+File: spinlock.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Sphynx spinlock
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+class Spinlock {
+public:
+    void lock() {
+        while (__atomic_test_and_set(&locked, __ATOMIC_ACQUIRE)) {
+            while (__atomic_load_n(&locked, __ATOMIC_RELAXED)) {
+                __asm__ volatile("pause");
+            }
+        }
+    }
+
+    // For paths that may run while their own CPU already holds the lock
+    bool try_lock() {
+        return !__atomic_test_and_set(&locked, __ATOMIC_ACQUIRE);
+    }
+
+    void unlock() {
+        __atomic_clear(&locked, __ATOMIC_RELEASE);
+    }
+
+private:
+    volatile bool locked = false;
+};
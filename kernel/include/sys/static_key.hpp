@@ -0,0 +1,76 @@
+/*
+Sphynx Operating System
+
+File: static_key.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Static keys, branches patched in the kernel text instead of tested at runtime
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t enabled;
+} static_key_t;
+
+// Emitted into __jump_table by every static branch, the linker script collects them between __jump_table_start and _end
+typedef struct {
+    uint64_t code;
+    uint64_t target;
+    uint64_t key;
+} jump_entry_t;
+
+// Evaluates to false through a 5 byte NOP while key is disabled. Enabling the key rewrites the NOP into a jmp to
+// the true path, so a disabled branch costs no load and no compare. key must be a global or static object
+#define static_branch_unlikely(key) \
+    ({ \
+        __label__ _skTrue, _skDone; \
+        bool _skTaken = false; \
+        __asm__ goto( \
+            "1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t" \
+            ".pushsection __jump_table, \"aw\"\n\t" \
+            ".balign 8\n\t" \
+            ".quad 1b, %l[_skTrue], %c0\n\t" \
+            ".popsection" \
+            : : "i"(&(key)) : : _skTrue); \
+        goto _skDone; \
+    _skTrue: \
+        _skTaken = true; \
+    _skDone: \
+        _skTaken; \
+    })
+
+namespace StaticKey {
+    // Patch every branch on key, return the number of sites rewritten. The text is written through the direct map,
+    // so keys can only change once the VMM is up
+    uint64_t enable(static_key_t* key);
+    uint64_t disable(static_key_t* key);
+
+    static inline bool is_enabled(const static_key_t* key) {
+        return __atomic_load_n(&key->enabled, __ATOMIC_RELAXED);
+    }
+}
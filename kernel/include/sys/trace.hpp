@@ -0,0 +1,107 @@
+/*
+Sphynx Operating System
+
+File: trace.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Binary trace records decoded on the host
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/static_key.hpp>
+
+#define TRACE_MAX_ARGS 5
+
+// Format strings live in their own section and a record only carries the string's offset in it, see tools/tracedecode.py
+extern "C" const char __trace_fmt_start[];
+
+namespace Trace {
+    // One cache line per record
+    typedef struct {
+        // Ring index plus one once the record is complete
+        uint64_t seq;
+        uint64_t tsc;
+        uint32_t id;
+        uint32_t count;
+        uint64_t args[TRACE_MAX_ARGS];
+    } entry_t;
+
+    // Sets up the trace ring of the calling CPU, earlier records are dropped
+    void init_cpu();
+    void record(uint32_t id, uint32_t count, const uint64_t* args);
+    // Writes every ring to the debug sinks as hex lines for the host decoder, oldest record first. Empty rings write nothing
+    void dump();
+
+    // A named site that records only while its static key is on, see TRACEPOINT
+    typedef struct {
+        const char* name;
+        static_key_t key;
+    } tracepoint_t;
+
+    // Turns every tracepoint called name on or off, returns how many there are
+    int set(const char* name, bool enabled);
+    // Prints each tracepoint and whether it is on
+    void list();
+    // Runs one line of the form "enable <name>", "disable <name>" or "list", a bare name enables it. Returns -1 on a bad line
+    int command(const char* line);
+    // Runs a text of commands, one per line, with # starting a comment. Used for /sys/trace.conf at boot
+    void load_config(const char* text, size_t length);
+
+    // Arguments are stored as raw words, %s can't be decoded on the host and shows up as a pointer
+    template<typename T>
+    static inline uint64_t word(T value) {
+        return (uint64_t)value;
+    }
+
+    template<typename... Args>
+    static inline void emit(const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= TRACE_MAX_ARGS, "too many trace arguments");
+        const uint64_t words[] = { 0, word(args)... };
+        record(static_cast<uint32_t>(format - __trace_fmt_start), sizeof...(Args), words + 1);
+    }
+}
+
+// Always built in, a disabled tracepoint is a single NOP in the text until Trace::set patches it into a jump
+#define TRACEPOINT(name, fmt, ...) \
+    do { \
+        __attribute__((section("__tracepoints"), used)) static Trace::tracepoint_t _tracepoint = { #name, { 0 } }; \
+        if (static_branch_unlikely(_tracepoint.key)) { \
+            __attribute__((section(".trace_fmt"), used)) static const char _traceFormat[] = fmt; \
+            Trace::emit(_traceFormat, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#if SPHYNX_TRACE
+#define TRACE(fmt, ...) \
+    do { \
+        __attribute__((section(".trace_fmt"), used)) static const char _traceFormat[] = fmt; \
+        Trace::emit(_traceFormat, ##__VA_ARGS__); \
+    } while (0)
+#else
+#define TRACE(fmt, ...) do { } while (0)
+#endif
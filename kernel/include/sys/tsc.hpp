@@ -0,0 +1,52 @@
+/*
+Sphynx Operating System
+
+File: tsc.hpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Time stamp counter helpers
+*/
+
+#pragma once
+
+#include <common.hpp>
+#include <stdint.h>
+
+namespace TSC {
+    static inline uint64_t read() {
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t)hi << 32) | lo;
+    }
+
+    // Remembers the TSC at kernel entry, the zero point of get_ns() and since_boot_ns()
+    void mark_boot();
+    // Calibrates the TSC against PIT channel 2, the conversions below return 0 until it has run
+    void init();
+    uint64_t get_frequency();
+    uint64_t ticks_to_ns(uint64_t ticks);
+    // Nanoseconds from boot to a raw TSC value, which may have been read before calibration
+    uint64_t since_boot_ns(uint64_t stamp);
+    uint64_t get_ns();
+}
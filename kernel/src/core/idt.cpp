@@ -29,8 +29,12 @@ Description: Sphynx IDT
 */
 
 #include <core/idt.hpp>
+#include <core/pic.hpp>
 #include <sys/cpu.hpp>
+#include <sys/percpu.hpp>
+#include <sys/trace.hpp>
 #include <dev/tty.hpp>
+#include <core/mm/vmm.hpp>
 
 namespace IDT {
     #define IDT_ENTRIES 256
@@ -41,6 +45,13 @@ namespace IDT {
     IDT::idt_entry_t idt[IDT_ENTRIES];
     IDT::idt_pointer_t idt_p;
 
+    typedef struct {
+        irq_handler_t handler;
+        void* ctx;
+    } irq_slot_t;
+
+    static irq_slot_t irqs[PIC_IRQ_COUNT];
+
     static const char* reasons[32] = {
         "Division by Zero",
         "Debug",
@@ -103,16 +114,50 @@ namespace IDT {
 
         load_idt((uint64_t)&idt_p);
         __asm__ volatile("cli");
+        PIC::init();
+    }
+
+    bool register_irq(uint8_t irq, irq_handler_t handler, void* ctx) {
+        if (irq >= PIC_IRQ_COUNT || irqs[irq].handler != nullptr) {
+            return false;
+        }
+        irqs[irq].ctx = ctx;
+        __atomic_store_n(&irqs[irq].handler, handler, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    static void dispatch_irq(uint8_t irq) {
+        if (PIC::is_spurious(irq)) {
+            return;
+        }
+
+        irq_handler_t handler = __atomic_load_n(&irqs[irq].handler, __ATOMIC_ACQUIRE);
+        if (handler != nullptr) {
+            handler(irq, irqs[irq].ctx);
+        } else {
+            // Nobody will ever acknowledge it at the device, keep it from firing forever
+            PIC::mask(irq);
+        }
+        PIC::eoi(irq);
     }
 
     extern "C" void excp_handler(IDT::int_frame_t frame) {
+        PerCPU::cpu_t* cpu = PerCPU::current();
+        cpu->irqDepth++;
+        TRACEPOINT(interrupt, "interrupt %llu err %llx rip %llx", frame.vector, frame.err, frame.rip);
+        if(frame.vector == 14 && VMM::handle_fault(frame.cr2, frame.err)) {
+            cpu->irqDepth--;
+            return;
+        }
+
         if(frame.vector < 0x20) {
             kpanic(&frame, reasons[frame.vector]);
             hcf();
         } else if(frame.vector >= 0x20 && frame.vector <= 0x2f) {
-            // TODO: IRQs
+            dispatch_irq(frame.vector - PIC_VECTOR_BASE);
         } else if(frame.vector == 0x80) {
             // TODO: System Calls
         }
+        cpu->irqDepth--;
     }
 }
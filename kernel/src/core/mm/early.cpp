@@ -0,0 +1,190 @@
+/*
+Sphynx Operating System
+
+File: early.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Early boot memory map sanitizer and bump allocator
+*/
+
+#include <core/mm/early.hpp>
+#include <core/mm/pmm.hpp>
+#include <math_utils.hpp>
+#include <dev/tty.hpp>
+#include <sys/cpu.hpp>
+#include <string.hpp>
+
+namespace Early {
+    #define MAX_RANGES 256
+
+    static range_t ranges[MAX_RANGES];
+    static uint64_t rangeCount = 0;
+
+    static uint64_t bumpBase = 0;
+    static uint64_t bumpCurrent = 0;
+    static uint64_t bumpEnd = 0;
+    static bool retired = false;
+
+    // Runs before the console exists, so failures can only go to the debug port
+    [[noreturn]] static void fail(const char* reason) {
+        kdprintf(" - Error: %s\n", reason);
+        hcf();
+    }
+
+    static void sort_points(uint64_t* points, uint64_t count) {
+        for (uint64_t i = 1; i < count; i++) {
+            uint64_t value = points[i];
+            uint64_t j = i;
+            while (j > 0 && points[j - 1] > value) {
+                points[j] = points[j - 1];
+                j--;
+            }
+            points[j] = value;
+        }
+    }
+
+    // Usable memory only wins where nothing else claims it, the first non usable type covering a slice is kept
+    static bool classify(memory_map_t *memmap, uint64_t base, uint64_t end, uint64_t* type) {
+        bool covered = false;
+        for (uint64_t i = 0; i < memmap->entry_count; i++) {
+            memory_map_entry_t* entry = memmap->entries[i];
+            if (entry->length == 0 || entry->base >= end || entry->base + entry->length <= base) {
+                continue;
+            }
+
+            if (entry->type != MEMMAP_USABLE) {
+                *type = entry->type;
+                return true;
+            }
+
+            covered = true;
+            *type = MEMMAP_USABLE;
+        }
+
+        return covered;
+    }
+
+    static void push_range(uint64_t base, uint64_t end, uint64_t type) {
+        if (rangeCount > 0) {
+            range_t* last = &ranges[rangeCount - 1];
+            if (last->end == base && last->type == type) {
+                last->end = end;
+                return;
+            }
+        }
+
+        if (rangeCount == MAX_RANGES) {
+            fail("Too many memory map ranges");
+        }
+
+        ranges[rangeCount++] = { base, end, type };
+    }
+
+    void init(memory_map_t *memmap) {
+        if (memmap == nullptr || memmap->entry_count == 0) {
+            fail("Empty memory map");
+        }
+
+        if (memmap->entry_count > MAX_RANGES) {
+            fail("Too many memory map entries");
+        }
+
+        uint64_t points[MAX_RANGES * 2];
+        uint64_t pointCount = 0;
+        for (uint64_t i = 0; i < memmap->entry_count; i++) {
+            memory_map_entry_t* entry = memmap->entries[i];
+            if (entry->length == 0) {
+                continue;
+            }
+            points[pointCount++] = entry->base;
+            points[pointCount++] = entry->base + entry->length;
+        }
+
+        sort_points(points, pointCount);
+
+        // Every slice between two boundaries has a single type, adjacent slices of the same type get merged
+        for (uint64_t i = 0; i + 1 < pointCount; i++) {
+            uint64_t type;
+            if (points[i] == points[i + 1] || !classify(memmap, points[i], points[i + 1], &type)) {
+                continue;
+            }
+            push_range(points[i], points[i + 1], type);
+        }
+
+        range_t* largest = nullptr;
+        for (uint64_t i = 0; i < rangeCount; i++) {
+            range_t* range = &ranges[i];
+            if (range->type != MEMMAP_USABLE) {
+                continue;
+            }
+            if (largest == nullptr || range->end - range->base > largest->end - largest->base) {
+                largest = range;
+            }
+        }
+
+        if (largest == nullptr) {
+            fail("No usable memory");
+        }
+
+        bumpBase = ALIGN_UP(MAX(largest->base, PAGE_SIZE), PAGE_SIZE);
+        bumpCurrent = bumpBase;
+        bumpEnd = ALIGN_DOWN(largest->end, PAGE_SIZE);
+    }
+
+    uint64_t get_range_count() {
+        return rangeCount;
+    }
+
+    const range_t* get_ranges() {
+        return ranges;
+    }
+
+    void* alloc(uint64_t size, uint64_t alignment) {
+        if (retired) {
+            kpanic(nullptr, "Early allocation after the PMM took over");
+        }
+
+        uint64_t base = ALIGN_UP(bumpCurrent, alignment);
+        if (base + size > bumpEnd || base + size < base) {
+            kpanic(nullptr, "Early allocator out of memory");
+        }
+
+        bumpCurrent = base + size;
+        memset(reinterpret_cast<void*>(base), 0, size);
+        return reinterpret_cast<void*>(base);
+    }
+
+    void retire(uint64_t* usedBase, uint64_t* usedEnd) {
+        retired = true;
+        *usedBase = bumpBase;
+        *usedEnd = ALIGN_UP(bumpCurrent, PAGE_SIZE);
+    }
+
+    void* flanterm_alloc(size_t size) {
+        return alloc(size);
+    }
+
+    void flanterm_free(void* ptr, size_t size) {
+    }
+}
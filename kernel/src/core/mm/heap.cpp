@@ -0,0 +1,449 @@
+/*
+Sphynx Operating System
+
+File: heap.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Sphynx kernel heap
+*/
+
+#include <core/mm/heap.hpp>
+#include <core/mm/pmm.hpp>
+#include <core/mm/vmm.hpp>
+#include <core/mm/profile.hpp>
+#include <sys/spinlock.hpp>
+#include <sys/cpu.hpp>
+#include <sys/trace.hpp>
+#include <dev/tty.hpp>
+#include <string.hpp>
+#include <math_utils.hpp>
+
+namespace Heap {
+    #define SLAB_MAX_ORDER 3
+    // Completely free slabs a cache holds on to before giving pages back to the PMM
+    #define SLAB_KEEP_EMPTY 2
+    // Page owner tags for kmalloc allocations that bypassed the slabs, on the first page and on the ones after it
+    #define LARGE_OWNER reinterpret_cast<void*>(1)
+    #define LARGE_TAIL reinterpret_cast<void*>(2)
+
+    // Lives at the start of the slab, followed by the free index stack, a bitmap of free objects and then the objects
+    typedef struct slab {
+        struct slab* next;
+        struct slab* prev;
+        cache_t* cache;
+        uint16_t inUse;
+        uint16_t freeTop;
+    } slab_t;
+
+    struct cache {
+        const char* name;
+        uint64_t size;
+        uint64_t order;
+        uint64_t capacity;
+        // Offset of the first object from the slab header
+        uint64_t objOffset;
+        ctor_t ctor;
+        Spinlock lock;
+        slab_t* partial;
+        slab_t* full;
+        slab_t* empty;
+        uint64_t emptyCount;
+        uint64_t slabCount;
+        uint64_t allocs;
+        uint64_t frees;
+        cache_t* next;
+    };
+
+    static const uint64_t classSizes[] = {
+        16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
+    };
+    #define CLASS_COUNT (sizeof(classSizes) / sizeof(classSizes[0]))
+
+    static cache_t cacheCache;
+    static cache_t* classCaches[CLASS_COUNT];
+    static cache_t* caches = nullptr;
+    static Spinlock cachesLock;
+    static bool ready = false;
+
+    static inline uint16_t* free_stack(slab_t* slab) {
+        return reinterpret_cast<uint16_t*>(slab + 1);
+    }
+
+    // Set bits are free objects, so a second free of the same object is caught even while the slab has live ones
+    static inline uint8_t* free_map(cache_t* cache, slab_t* slab) {
+        return reinterpret_cast<uint8_t*>(free_stack(slab) + cache->capacity);
+    }
+
+    static inline uint8_t* object_at(cache_t* cache, slab_t* slab, uint64_t index) {
+        return reinterpret_cast<uint8_t*>(slab) + cache->objOffset + index * cache->size;
+    }
+
+    static void list_push(slab_t** list, slab_t* slab) {
+        slab->prev = nullptr;
+        slab->next = *list;
+        if (*list) {
+            (*list)->prev = slab;
+        }
+        *list = slab;
+    }
+
+    static void list_remove(slab_t** list, slab_t* slab) {
+        if (slab->prev) {
+            slab->prev->next = slab->next;
+        } else {
+            *list = slab->next;
+        }
+        if (slab->next) {
+            slab->next->prev = slab->prev;
+        }
+    }
+
+    // Picks the smallest slab order that wastes at most 1/8 of the slab
+    static void layout(cache_t* cache, uint64_t align) {
+        for (uint64_t order = 0; order <= SLAB_MAX_ORDER; order++) {
+            uint64_t bytes = PAGE_SIZE << order;
+            // Every object costs its size, a stack slot and a bit in the free map
+            uint64_t capacity = (bytes - sizeof(slab_t)) * 8 / (cache->size * 8 + sizeof(uint16_t) * 8 + 1);
+            uint64_t offset = 0;
+            while (capacity > 0) {
+                offset = ALIGN_UP(sizeof(slab_t) + capacity * sizeof(uint16_t) + DIV_ROUNDUP(capacity, 8), align);
+                if (offset + capacity * cache->size <= bytes) {
+                    break;
+                }
+                capacity--;
+            }
+            if (capacity > 0xFFFF) {
+                capacity = 0xFFFF;
+            }
+
+            uint64_t waste = bytes - capacity * cache->size;
+            cache->order = order;
+            cache->capacity = capacity;
+            cache->objOffset = offset;
+            if (capacity > 0 && waste * 8 <= bytes) {
+                return;
+            }
+        }
+    }
+
+    static void cache_setup(cache_t* cache, const char* name, size_t size, size_t align, ctor_t ctor) {
+        if (align < 8) {
+            align = 8;
+        }
+        memset(cache, 0, sizeof(cache_t));
+        cache->name = name;
+        cache->size = ALIGN_UP(size, align);
+        cache->ctor = ctor;
+        layout(cache, align);
+        if (cache->capacity == 0) {
+            kpanic(nullptr, "Heap: object size too large for a slab cache");
+        }
+
+        cachesLock.lock();
+        cache->next = caches;
+        caches = cache;
+        cachesLock.unlock();
+    }
+
+    static slab_t* slab_create(cache_t* cache) {
+        void* phys = PMM::request_pages(1ull << cache->order);
+        if (!phys) {
+            return nullptr;
+        }
+
+        slab_t* slab = static_cast<slab_t*>(VMM::phys_to_virt(reinterpret_cast<uint64_t>(phys)));
+        slab->cache = cache;
+        slab->inUse = 0;
+        slab->freeTop = cache->capacity;
+        uint16_t* stack = free_stack(slab);
+        memset(free_map(cache, slab), 0xFF, DIV_ROUNDUP(cache->capacity, 8));
+        for (uint64_t i = 0; i < cache->capacity; i++) {
+            // Lowest index on top so fresh slabs fill front to back
+            stack[i] = cache->capacity - 1 - i;
+            if (cache->ctor) {
+                cache->ctor(object_at(cache, slab, i));
+            }
+        }
+
+        for (uint64_t i = 0; i < (1ull << cache->order); i++) {
+            PMM::set_page_owner(static_cast<uint8_t*>(phys) + i * PAGE_SIZE, slab);
+        }
+        cache->slabCount++;
+        return slab;
+    }
+
+    static void slab_destroy(cache_t* cache, slab_t* slab) {
+        void* phys = reinterpret_cast<void*>(VMM::virt_to_phys(slab));
+        for (uint64_t i = 0; i < (1ull << cache->order); i++) {
+            PMM::set_page_owner(static_cast<uint8_t*>(phys) + i * PAGE_SIZE, nullptr);
+        }
+        cache->slabCount--;
+        PMM::free_pages(phys);
+    }
+
+    void* cache_alloc(cache_t* cache) {
+        uint64_t flags = irq_save();
+        cache->lock.lock();
+
+        slab_t* slab = cache->partial;
+        if (!slab && cache->empty) {
+            slab = cache->empty;
+            list_remove(&cache->empty, slab);
+            cache->emptyCount--;
+            list_push(&cache->partial, slab);
+        }
+        if (!slab) {
+            slab = slab_create(cache);
+            if (!slab) {
+                cache->lock.unlock();
+                irq_restore(flags);
+                return nullptr;
+            }
+            list_push(&cache->partial, slab);
+        }
+
+        uint16_t index = free_stack(slab)[--slab->freeTop];
+        free_map(cache, slab)[index / 8] &= ~(1 << (index % 8));
+        slab->inUse++;
+        if (slab->freeTop == 0) {
+            list_remove(&cache->partial, slab);
+            list_push(&cache->full, slab);
+        }
+        cache->allocs++;
+
+        cache->lock.unlock();
+        irq_restore(flags);
+
+        void* object = object_at(cache, slab, index);
+        ALLOC_PROFILE_ALLOC(object, cache->size, AllocProfile::SOURCE_HEAP);
+        return object;
+    }
+
+    static void slab_free(cache_t* cache, slab_t* slab, void* object) {
+        uint64_t offset = static_cast<uint8_t*>(object) - reinterpret_cast<uint8_t*>(slab) - cache->objOffset;
+        uint64_t index = offset / cache->size;
+        if (offset % cache->size != 0 || index >= cache->capacity) {
+            kpanic(nullptr, "Heap: freeing a pointer that is not the start of an object");
+        }
+
+        uint64_t flags = irq_save();
+        cache->lock.lock();
+        uint8_t* map = free_map(cache, slab);
+        if (map[index / 8] & (1 << (index % 8))) {
+            kpanic(nullptr, "Heap: double free");
+        }
+        map[index / 8] |= 1 << (index % 8);
+
+        if (slab->freeTop == 0) {
+            list_remove(&cache->full, slab);
+            list_push(&cache->partial, slab);
+        }
+        free_stack(slab)[slab->freeTop++] = index;
+        slab->inUse--;
+        cache->frees++;
+
+        if (slab->inUse == 0) {
+            list_remove(&cache->partial, slab);
+            if (cache->emptyCount < SLAB_KEEP_EMPTY) {
+                list_push(&cache->empty, slab);
+                cache->emptyCount++;
+            } else {
+                slab_destroy(cache, slab);
+            }
+        }
+        cache->lock.unlock();
+        irq_restore(flags);
+    }
+
+    static slab_t* slab_of(void* object) {
+        return static_cast<slab_t*>(PMM::get_page_owner(reinterpret_cast<void*>(VMM::virt_to_phys(object))));
+    }
+
+    void cache_free(cache_t* cache, void* object) {
+        slab_t* slab = slab_of(object);
+        if (slab == nullptr || slab == LARGE_OWNER || slab == LARGE_TAIL || slab->cache != cache) {
+            kpanic(nullptr, "Heap: object freed to the wrong cache");
+        }
+        ALLOC_PROFILE_FREE(object, AllocProfile::SOURCE_HEAP);
+        slab_free(cache, slab, object);
+    }
+
+    cache_t* cache_create(const char* name, size_t size, size_t align, ctor_t ctor) {
+        if (align == 0 || (align & (align - 1)) != 0) {
+            kpanic(nullptr, "Heap: cache alignment is not a power of two");
+        }
+
+        cache_t* cache = static_cast<cache_t*>(cache_alloc(&cacheCache));
+        if (!cache) {
+            return nullptr;
+        }
+        cache_setup(cache, name, size, align, ctor);
+        return cache;
+    }
+
+    static const char* classNames[CLASS_COUNT] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-48", "kmalloc-64", "kmalloc-96", "kmalloc-128",
+        "kmalloc-192", "kmalloc-256", "kmalloc-384", "kmalloc-512", "kmalloc-768", "kmalloc-1024",
+        "kmalloc-1536", "kmalloc-2048", "kmalloc-3072", "kmalloc-4096"
+    };
+
+    void init() {
+        cache_setup(&cacheCache, "cache", sizeof(cache_t), alignof(cache_t), nullptr);
+        for (uint64_t i = 0; i < CLASS_COUNT; i++) {
+            classCaches[i] = cache_create(classNames[i], classSizes[i], 16, nullptr);
+            if (!classCaches[i]) {
+                kpanic(nullptr, "Heap: failed to create the kmalloc caches");
+            }
+        }
+        ready = true;
+    }
+
+    static cache_t* class_for(size_t size) {
+        for (uint64_t i = 0; i < CLASS_COUNT; i++) {
+            if (size <= classSizes[i]) {
+                return classCaches[i];
+            }
+        }
+        return nullptr;
+    }
+
+    void dump_stats() {
+        Logger logger("Heap");
+        cachesLock.lock();
+        for (cache_t* cache = caches; cache; cache = cache->next) {
+            logger.log(Logger::Level::DEBUG, "%-13s: %llu byte objects, %llu per %llu KiB slab, %llu slabs, %llu live\n",
+                cache->name, cache->size, cache->capacity, (PAGE_SIZE << cache->order) / 1024, cache->slabCount,
+                cache->allocs - cache->frees);
+        }
+        cachesLock.unlock();
+    }
+}
+
+static void* heap_alloc(size_t size) {
+    if (!Heap::ready) {
+        kpanic(nullptr, "kmalloc called before the heap was initialized");
+    }
+    if (size == 0) {
+        size = 1;
+    }
+
+    if (size <= HEAP_MAX_CLASS) {
+        return Heap::cache_alloc(Heap::class_for(size));
+    }
+
+    uint64_t pageCount = DIV_ROUNDUP(size, PAGE_SIZE);
+    void* phys = PMM::request_pages(pageCount);
+    if (!phys) {
+        return nullptr;
+    }
+    PMM::set_page_owner(phys, LARGE_OWNER);
+    for (uint64_t i = 1; i < pageCount; i++) {
+        PMM::set_page_owner(static_cast<uint8_t*>(phys) + i * PAGE_SIZE, LARGE_TAIL);
+    }
+    return VMM::phys_to_virt(reinterpret_cast<uint64_t>(phys));
+}
+
+void* kmalloc(size_t size) {
+    void* ptr = heap_alloc(size);
+    ALLOC_PROFILE_ALLOC(ptr, size, AllocProfile::SOURCE_HEAP);
+    TRACE("kmalloc %llu -> %p", size, ptr);
+    return ptr;
+}
+
+void* kcalloc(size_t count, size_t size) {
+    if (size != 0 && count > static_cast<size_t>(-1) / size) {
+        return nullptr;
+    }
+    void* ptr = heap_alloc(count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    ALLOC_PROFILE_ALLOC(ptr, count * size, AllocProfile::SOURCE_HEAP);
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    ALLOC_PROFILE_FREE(ptr, AllocProfile::SOURCE_HEAP);
+    TRACE("kfree %p", ptr);
+
+    Heap::slab_t* slab = Heap::slab_of(ptr);
+    if (slab == LARGE_OWNER) {
+        uint8_t* phys = reinterpret_cast<uint8_t*>(VMM::virt_to_phys(ptr));
+        if (reinterpret_cast<uintptr_t>(phys) & (PAGE_SIZE - 1)) {
+            kpanic(nullptr, "kfree of a pointer into the middle of an allocation");
+        }
+        PMM::set_page_owner(phys, nullptr);
+        for (uint8_t* page = phys + PAGE_SIZE; PMM::get_page_owner(page) == LARGE_TAIL; page += PAGE_SIZE) {
+            PMM::set_page_owner(page, nullptr);
+        }
+        PMM::free_pages(phys);
+        return;
+    }
+    if (slab == LARGE_TAIL) {
+        kpanic(nullptr, "kfree of a pointer into the middle of an allocation");
+    }
+    if (slab == nullptr) {
+        kpanic(nullptr, "kfree of a pointer that was not allocated by kmalloc");
+    }
+    Heap::slab_free(slab->cache, slab, ptr);
+}
+
+static void* checked_alloc(size_t size) {
+    void* ptr = heap_alloc(size);
+    if (!ptr) {
+        kpanic(nullptr, "Out of memory in operator new");
+    }
+    return ptr;
+}
+
+void* operator new(size_t size) {
+    void* ptr = checked_alloc(size);
+    ALLOC_PROFILE_ALLOC(ptr, size, AllocProfile::SOURCE_HEAP);
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    void* ptr = checked_alloc(size);
+    ALLOC_PROFILE_ALLOC(ptr, size, AllocProfile::SOURCE_HEAP);
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    kfree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    kfree(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    kfree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    kfree(ptr);
+}
@@ -29,28 +29,830 @@ Description: Sphynx physical memory manager
 */
 
 #include <core/mm/pmm.hpp>
+#include <core/mm/profile.hpp>
+#include <core/mm/early.hpp>
+#include <core/mm/mm_lock.hpp>
 #include <math_utils.hpp>
 #include <dev/tty.hpp>
 #include <sys/cpu.hpp>
+#include <sys/tsc.hpp>
+#include <sys/percpu.hpp>
+#include <sys/trace.hpp>
 #include <string.hpp>
 
 namespace PMM {
-    void init(memory_map_t *memmap) {
-        if (memmap == nullptr) {
-            kpanic(nullptr, "NULL Memory map");
+    #define PAGE_FREE (1 << 7)
+    #define PAGE_USED (1 << 6)
+    #define PAGE_CACHED (1 << 5)
+    #define PAGE_ORDER_MASK 0x0F
+
+    // Magazines sized to 512 bytes
+    #define MAGAZINE_SIZE 62
+    #define DEPOT_MAX_FULL 16
+
+    // 4 MiB of known-zero pages, filled from idle time
+    #define ZERO_POOL_SIZE 1024
+
+    // Per page metadata, only the first page of a block carries the flags and order
+    typedef struct {
+        uint8_t flags;
+        uint8_t reserved;
+        // References beyond the first owner, used for pages shared copy-on-write
+        uint16_t refs;
+        // Whoever carved the page up, e.g. the slab a heap object lives in
+        void* owner;
+    } page_t;
+
+    // Free blocks are linked through their own first page
+    typedef struct free_block {
+        struct free_block* next;
+        struct free_block* prev;
+    } free_block_t;
+
+    typedef struct magazine {
+        struct magazine* next;
+        uint64_t count;
+        void* pages[MAGAZINE_SIZE];
+    } magazine_t;
+
+    // Each CPU keeps a loaded and a previous magazine, previous is always either full or empty
+    typedef struct {
+        magazine_t* loaded;
+        magazine_t* previous;
+        cache_stats_t stats;
+    } __attribute__((aligned(64))) cpu_cache_t;
+
+    static struct {
+        MmLock lock;
+        magazine_t* full;
+        magazine_t* empty;
+        uint64_t fullCount;
+    } depot;
+
+    static cpu_cache_t cpuCaches[SPHYNX_MAX_CPUS];
+
+    // Pages in the pool are marked PAGE_CACHED, their contents are never touched so the stack lives elsewhere
+    static struct {
+        MmLock lock;
+        void** pages;
+        uint64_t count;
+        zero_stats_t stats;
+    } zeroPool;
+
+    // Zone boundaries are 4 MiB aligned, so no buddy block ever straddles two zones
+    #define ZONE_DMA_END 0x1000000ull
+    #define ZONE_DMA32_END 0x100000000ull
+
+    typedef struct {
+        free_block_t* freeLists[MAX_ORDER];
+        uint64_t freePages;
+        // Pages a zone keeps back from allocations that fell back from a higher zone
+        uint64_t reserve;
+    } zone_t;
+
+    static const char* zoneNames[ZONE_COUNT] = { "DMA", "DMA32", "Normal" };
+
+    static page_t* pages = nullptr;
+    static uint64_t totalPages = 0;
+    static zone_t zones[ZONE_COUNT] = {};
+    static MmLock lock;
+
+    #define MAX_SHRINKERS 8
+    static shrinker_t shrinkers[MAX_SHRINKERS];
+    static uint32_t shrinkerCount = 0;
+
+    static inline free_block_t* pfn_to_block(uint64_t pfn) {
+        return reinterpret_cast<free_block_t*>(pfn * PAGE_SIZE);
+    }
+
+    static inline void clear_pages(void* ptr, uint64_t count) {
+        uint64_t qwords = count * PAGE_SIZE / sizeof(uint64_t);
+        __asm__ volatile("rep stosq" : "+D"(ptr), "+c"(qwords) : "a"(0ull) : "memory");
+    }
+
+    static inline zone_t* zone_of(uint64_t pfn) {
+        uint64_t addr = pfn * PAGE_SIZE;
+        if (addr < ZONE_DMA_END) {
+            return &zones[ZONE_DMA];
+        } else if (addr < ZONE_DMA32_END) {
+            return &zones[ZONE_DMA32];
+        }
+        return &zones[ZONE_NORMAL];
+    }
+
+    static inline uint8_t order_for(uint64_t count) {
+        uint8_t order = 0;
+        while ((1ull << order) < count) {
+            order++;
+        }
+        return order;
+    }
+
+    static void list_push(zone_t* zone, uint8_t order, uint64_t pfn) {
+        free_block_t* block = pfn_to_block(pfn);
+        block->prev = nullptr;
+        block->next = zone->freeLists[order];
+        if (zone->freeLists[order] != nullptr) {
+            zone->freeLists[order]->prev = block;
+        }
+        zone->freeLists[order] = block;
+        pages[pfn].flags = PAGE_FREE | order;
+    }
+
+    static void list_remove(zone_t* zone, uint8_t order, uint64_t pfn) {
+        free_block_t* block = pfn_to_block(pfn);
+        if (block->prev != nullptr) {
+            block->prev->next = block->next;
+        } else {
+            zone->freeLists[order] = block->next;
+        }
+        if (block->next != nullptr) {
+            block->next->prev = block->prev;
+        }
+        pages[pfn].flags = 0;
+    }
+
+    static void free_block(uint64_t pfn, uint8_t order) {
+        zone_t* zone = zone_of(pfn);
+        zone->freePages += 1ull << order;
+        // An upper buddy merges into its lower half and only the merged head is relabelled, so drop the in use
+        // mark here or a second free of this pfn would still pass the check in free_pages
+        pages[pfn].flags = 0;
+
+        while (order < MAX_ORDER - 1) {
+            uint64_t buddy = pfn ^ (1ull << order);
+            if (buddy >= totalPages || pages[buddy].flags != (PAGE_FREE | order)) {
+                break;
+            }
+
+            list_remove(zone, order, buddy);
+            pfn &= ~(1ull << order);
+            order++;
+        }
+
+        list_push(zone, order, pfn);
+    }
+
+    // Whether pfn heads a block handed out by request_pages, anything else passed to free_pages is a caller bug
+    static bool is_allocated(uint64_t pfn) {
+        return pfn < totalPages && (pages[pfn].flags & PAGE_USED) && !(pages[pfn].flags & PAGE_CACHED);
+    }
+
+    // Returns the first pfn of the block, 0 on failure since page 0 is never handed out
+    static uint64_t alloc_block(zone_t* zone, uint8_t order) {
+        uint8_t current = order;
+        while (current < MAX_ORDER && zone->freeLists[current] == nullptr) {
+            current++;
+        }
+
+        if (current == MAX_ORDER) {
+            return 0;
+        }
+
+        uint64_t pfn = reinterpret_cast<uintptr_t>(zone->freeLists[current]) / PAGE_SIZE;
+        list_remove(zone, current, pfn);
+
+        while (current > order) {
+            current--;
+            list_push(zone, current, pfn + (1ull << current));
+        }
+
+        pages[pfn].flags = PAGE_USED | order;
+        zone->freePages -= 1ull << order;
+        return pfn;
+    }
+
+    // Tries the highest allowed zone first and only dips into lower zones above their reserve
+    static uint64_t alloc_zoned(uint8_t order, Zone highest) {
+        for (int z = highest; z >= 0; z--) {
+            zone_t* zone = &zones[z];
+            if (z != highest && zone->freePages < zone->reserve + (1ull << order)) {
+                continue;
+            }
+
+            uint64_t pfn = alloc_block(zone, order);
+            if (pfn != 0) {
+                return pfn;
+            }
+        }
+
+        return 0;
+    }
+
+    // Caller holds the depot lock
+    static magazine_t* depot_get_empty() {
+        magazine_t* mag = depot.empty;
+        if (mag != nullptr) {
+            depot.empty = mag->next;
+        }
+        return mag;
+    }
+
+    // Returns every page in a magazine to the buddy allocator, caller holds the lock
+    static uint64_t magazine_empty(magazine_t* mag) {
+        uint64_t freed = mag->count;
+        while (mag->count > 0) {
+            uint64_t page = reinterpret_cast<uintptr_t>(mag->pages[--mag->count]) / PAGE_SIZE;
+            pages[page].flags &= ~PAGE_CACHED;
+            free_block(page, 0);
+        }
+        return freed;
+    }
+
+    static bool cache_reload(cpu_cache_t* cache) {
+        depot.lock.lock();
+        magazine_t* full = depot.full;
+        if (full != nullptr) {
+            depot.full = full->next;
+            depot.fullCount--;
+            if (cache->previous != nullptr) {
+                cache->previous->next = depot.empty;
+                depot.empty = cache->previous;
+            }
+            cache->previous = cache->loaded;
+            cache->loaded = full;
+            depot.lock.unlock();
+            return true;
+        }
+
+        if (cache->loaded == nullptr) {
+            cache->loaded = depot_get_empty();
+        }
+        depot.lock.unlock();
+
+        magazine_t* mag = cache->loaded;
+        if (mag == nullptr) {
+            return false;
+        }
+
+        lock.lock();
+        while (mag->count < MAGAZINE_SIZE) {
+            uint64_t pfn = alloc_zoned(0, ZONE_NORMAL);
+            if (pfn == 0) {
+                break;
+            }
+            pages[pfn].flags |= PAGE_CACHED;
+            mag->pages[mag->count++] = reinterpret_cast<void*>(pfn * PAGE_SIZE);
+        }
+        lock.unlock();
+
+        cache->stats.refills++;
+        return mag->count > 0;
+    }
+
+    static void* cache_alloc() {
+        uint64_t flags = irq_save();
+        cpu_cache_t* cache = &cpuCaches[PerCPU::id()];
+
+        if (cache->loaded == nullptr || cache->loaded->count == 0) {
+            if (cache->previous != nullptr && cache->previous->count > 0) {
+                magazine_t* tmp = cache->loaded;
+                cache->loaded = cache->previous;
+                cache->previous = tmp;
+                cache->stats.hits++;
+            } else {
+                cache->stats.misses++;
+                if (!cache_reload(cache)) {
+                    irq_restore(flags);
+                    return nullptr;
+                }
+            }
+        } else {
+            cache->stats.hits++;
+        }
+
+        void* page = cache->loaded->pages[--cache->loaded->count];
+        pages[reinterpret_cast<uintptr_t>(page) / PAGE_SIZE].flags &= ~PAGE_CACHED;
+        irq_restore(flags);
+        return page;
+    }
+
+    static void cache_free(uint64_t pfn) {
+        uint64_t flags = irq_save();
+        cpu_cache_t* cache = &cpuCaches[PerCPU::id()];
+
+        if (cache->loaded == nullptr || cache->loaded->count == MAGAZINE_SIZE) {
+            if (cache->previous != nullptr && cache->previous->count == 0) {
+                magazine_t* tmp = cache->loaded;
+                cache->loaded = cache->previous;
+                cache->previous = tmp;
+                cache->stats.hits++;
+            } else {
+                cache->stats.misses++;
+                magazine_t* drain = nullptr;
+
+                depot.lock.lock();
+                if (cache->previous != nullptr) {
+                    cache->previous->next = depot.full;
+                    depot.full = cache->previous;
+                    depot.fullCount++;
+                }
+                cache->previous = cache->loaded;
+                cache->loaded = depot_get_empty();
+
+                if (depot.fullCount > DEPOT_MAX_FULL) {
+                    drain = depot.full;
+                    depot.full = drain->next;
+                    depot.fullCount--;
+                }
+                depot.lock.unlock();
+
+                if (drain != nullptr) {
+                    lock.lock();
+                    magazine_empty(drain);
+                    lock.unlock();
+
+                    depot.lock.lock();
+                    drain->next = depot.empty;
+                    depot.empty = drain;
+                    depot.lock.unlock();
+                    cache->stats.drains++;
+                }
+
+                if (cache->loaded == nullptr) {
+                    lock.lock();
+                    free_block(pfn, 0);
+                    lock.unlock();
+                    irq_restore(flags);
+                    return;
+                }
+            }
+        } else {
+            cache->stats.hits++;
+        }
+
+        pages[pfn].flags |= PAGE_CACHED;
+        cache->loaded->pages[cache->loaded->count++] = reinterpret_cast<void*>(pfn * PAGE_SIZE);
+        irq_restore(flags);
+    }
+
+    static void add_range(uint64_t base, uint64_t end) {
+        uint64_t start = DIV_ROUNDUP(base, PAGE_SIZE);
+        uint64_t last = end / PAGE_SIZE;
+
+        if (start == 0) {
+            start = 1;
+        }
+
+        while (start < last) {
+            uint8_t order = MAX_ORDER - 1;
+            while (order > 0 && ((start & ((1ull << order) - 1)) || start + (1ull << order) > last)) {
+                order--;
+            }
+
+            free_block(start, order);
+            start += 1ull << order;
+        }
+    }
+
+    void init() {
+        const Early::range_t* ranges = Early::get_ranges();
+        uint64_t rangeCount = Early::get_range_count();
+
+        uint64_t top = 0;
+        for (uint64_t i = 0; i < rangeCount; i++) {
+            if (ranges[i].type == MEMMAP_USABLE) {
+                top = MAX(top, ranges[i].end);
+            }
         }
+
+        // All of the allocator's own bookkeeping comes from the early allocator and is never freed
+        totalPages = top / PAGE_SIZE;
+        pages = static_cast<page_t*>(Early::alloc(totalPages * sizeof(page_t), PAGE_SIZE));
+        zeroPool.pages = static_cast<void**>(Early::alloc(ZERO_POOL_SIZE * sizeof(void*), PAGE_SIZE));
+
+        // Enough magazines for every CPU's pair plus a full depot, so the caches never allocate on their own
+        uint64_t magazineCount = SPHYNX_MAX_CPUS * 2 + DEPOT_MAX_FULL + 1;
+        magazine_t* mags = static_cast<magazine_t*>(Early::alloc(magazineCount * sizeof(magazine_t), 64));
+        for (uint64_t i = 0; i < magazineCount; i++) {
+            mags[i].next = depot.empty;
+            depot.empty = &mags[i];
+        }
+
+        uint64_t usedBase, usedEnd;
+        Early::retire(&usedBase, &usedEnd);
+
+        for (uint64_t i = 0; i < rangeCount; i++) {
+            if (ranges[i].type != MEMMAP_USABLE) {
+                continue;
+            }
+
+            uint64_t base = ranges[i].base;
+            uint64_t end = ranges[i].end;
+            if (usedBase >= base && usedBase < end) {
+                add_range(base, usedBase);
+                add_range(usedEnd, end);
+            } else {
+                add_range(base, end);
+            }
+        }
+
+        // ISA DMA memory is only handed out on request, DMA32 keeps a sixteenth back for drivers
+        zones[ZONE_DMA].reserve = zones[ZONE_DMA].freePages;
+        zones[ZONE_DMA32].reserve = zones[ZONE_DMA32].freePages / 16;
     }
 
     uint64_t get_free() {
-        uint64_t free = 0;
-        return free;
+        uint64_t cached = depot.fullCount * MAGAZINE_SIZE;
+        for (uint32_t i = 0; i < SPHYNX_MAX_CPUS; i++) {
+            if (cpuCaches[i].loaded != nullptr) {
+                cached += cpuCaches[i].loaded->count;
+            }
+            if (cpuCaches[i].previous != nullptr) {
+                cached += cpuCaches[i].previous->count;
+            }
+        }
+
+        uint64_t free = cached + zeroPool.count;
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            free += zones[z].freePages;
+        }
+
+        return free * PAGE_SIZE;
+    }
+
+    uint64_t get_free_zone(Zone zone) {
+        if (zone >= ZONE_COUNT) {
+            return 0;
+        }
+        return zones[zone].freePages * PAGE_SIZE;
+    }
+
+    void dump_zones() {
+        Logger logger("PMM");
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            logger.log(Logger::Level::INFO, "Zone %-6s: %llu KiB free, %llu KiB reserved\n", zoneNames[z],
+                zones[z].freePages * PAGE_SIZE / 1024, zones[z].reserve * PAGE_SIZE / 1024);
+        }
+    }
+
+    // Empties the depot and this CPU's magazines into the buddy allocator. Other CPUs' magazines are only touched
+    // by their owners, at most two magazines per CPU stay out of reach
+    static uint64_t drain_magazines() {
+        uint64_t flags = irq_save();
+        cpu_cache_t* cache = &cpuCaches[PerCPU::id()];
+
+        depot.lock.lock();
+        magazine_t* full = depot.full;
+        depot.full = nullptr;
+        depot.fullCount = 0;
+        depot.lock.unlock();
+
+        uint64_t freed = 0;
+        magazine_t* last = nullptr;
+        lock.lock();
+        if (cache->loaded != nullptr) {
+            freed += magazine_empty(cache->loaded);
+        }
+        if (cache->previous != nullptr) {
+            freed += magazine_empty(cache->previous);
+        }
+        for (magazine_t* mag = full; mag != nullptr; mag = mag->next) {
+            freed += magazine_empty(mag);
+            last = mag;
+        }
+        lock.unlock();
+
+        if (last != nullptr) {
+            depot.lock.lock();
+            last->next = depot.empty;
+            depot.empty = full;
+            depot.lock.unlock();
+        }
+        if (freed != 0) {
+            cache->stats.drains++;
+        }
+        irq_restore(flags);
+        return freed;
+    }
+
+    // Gives cached and pre-zeroed pages back to the buddy allocator, returns how many pages came back.
+    // Shrinkers only run when the zero pool alone doesn't cover the request, and the magazines are drained last
+    // so single pages the shrinkers freed into them reach the buddy allocator too
+    static uint64_t reclaim(uint64_t wanted) {
+        zeroPool.lock.lock();
+        uint64_t pooled = zeroPool.count;
+        if (pooled != 0) {
+            lock.lock();
+            while (zeroPool.count > 0) {
+                uint64_t pfn = reinterpret_cast<uintptr_t>(zeroPool.pages[--zeroPool.count]) / PAGE_SIZE;
+                pages[pfn].flags &= ~PAGE_CACHED;
+                free_block(pfn, 0);
+            }
+            lock.unlock();
+            zeroPool.stats.reclaimed += pooled;
+        }
+        zeroPool.lock.unlock();
+
+        uint64_t freed = pooled;
+        uint32_t count = __atomic_load_n(&shrinkerCount, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < count && freed < wanted; i++) {
+            freed += shrinkers[i](wanted - freed);
+        }
+        return freed + drain_magazines();
+    }
+
+    bool register_shrinker(shrinker_t shrinker) {
+        lock.lock();
+        uint32_t count = shrinkerCount;
+        if (count == MAX_SHRINKERS) {
+            lock.unlock();
+            return false;
+        }
+        shrinkers[count] = shrinker;
+        __atomic_store_n(&shrinkerCount, count + 1, __ATOMIC_RELEASE);
+        lock.unlock();
+        return true;
+    }
+
+    // Buddy allocation with one retry after reclaiming, call without the lock held
+    static uint64_t alloc_or_reclaim(uint8_t order, Zone highest) {
+        lock.lock();
+        uint64_t pfn = alloc_zoned(order, highest);
+        lock.unlock();
+
+        if (pfn == 0 && reclaim(1ull << order) != 0) {
+            lock.lock();
+            pfn = alloc_zoned(order, highest);
+            lock.unlock();
+        }
+        return pfn;
+    }
+
+    void* request_zeroed_pages(uint64_t pageCount) {
+        if (pageCount == 1) {
+            zeroPool.lock.lock();
+            if (zeroPool.count > 0) {
+                void* page = zeroPool.pages[--zeroPool.count];
+                pages[reinterpret_cast<uintptr_t>(page) / PAGE_SIZE].flags &= ~PAGE_CACHED;
+                zeroPool.stats.hits++;
+                zeroPool.lock.unlock();
+                ALLOC_PROFILE_ALLOC(page, PAGE_SIZE, AllocProfile::SOURCE_PMM);
+                return page;
+            }
+            zeroPool.lock.unlock();
+        }
+
+        __atomic_fetch_add(&zeroPool.stats.misses, 1, __ATOMIC_RELAXED);
+        void* ptr = request_pages(pageCount);
+        if (ptr != nullptr) {
+            clear_pages(ptr, pageCount);
+        }
+        ALLOC_PROFILE_ALLOC(ptr, pageCount * PAGE_SIZE, AllocProfile::SOURCE_PMM);
+        return ptr;
+    }
+
+    uint64_t zero_idle(uint64_t budget) {
+        uint64_t done = 0;
+        while (done < budget && __atomic_load_n(&zeroPool.count, __ATOMIC_RELAXED) < ZERO_POOL_SIZE) {
+            // Straight from the caches, going through request_pages would reclaim the pool to refill it
+            void* page = cache_alloc();
+            if (page == nullptr) {
+                break;
+            }
+
+            clear_pages(page, 1);
+
+            zeroPool.lock.lock();
+            if (zeroPool.count == ZERO_POOL_SIZE) {
+                zeroPool.lock.unlock();
+                cache_free(reinterpret_cast<uintptr_t>(page) / PAGE_SIZE);
+                break;
+            }
+            pages[reinterpret_cast<uintptr_t>(page) / PAGE_SIZE].flags |= PAGE_CACHED;
+            zeroPool.pages[zeroPool.count++] = page;
+            zeroPool.stats.idleZeroed++;
+            zeroPool.lock.unlock();
+            done++;
+        }
+
+        return done;
+    }
+
+    zero_stats_t get_zero_stats() {
+        zeroPool.lock.lock();
+        zero_stats_t stats = zeroPool.stats;
+        stats.poolPages = zeroPool.count;
+        zeroPool.lock.unlock();
+        return stats;
+    }
+
+    void page_get(void* page) {
+        __atomic_fetch_add(&pages[reinterpret_cast<uintptr_t>(page) / PAGE_SIZE].refs, 1, __ATOMIC_RELAXED);
+    }
+
+    bool page_put(void* page) {
+        page_t* meta = &pages[reinterpret_cast<uintptr_t>(page) / PAGE_SIZE];
+        uint16_t refs = __atomic_load_n(&meta->refs, __ATOMIC_ACQUIRE);
+        while (true) {
+            if (refs == 0) {
+                free_pages(page);
+                return true;
+            }
+
+            if (__atomic_compare_exchange_n(&meta->refs, &refs, refs - 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return false;
+            }
+        }
+    }
+
+    void set_page_owner(void* page, void* owner) {
+        pages[reinterpret_cast<uintptr_t>(page) / PAGE_SIZE].owner = owner;
+    }
+
+    void* get_page_owner(void* ptr) {
+        uint64_t pfn = reinterpret_cast<uintptr_t>(ptr) / PAGE_SIZE;
+        return pfn < totalPages ? pages[pfn].owner : nullptr;
+    }
+
+    uint64_t page_count(void* page) {
+        return __atomic_load_n(&pages[reinterpret_cast<uintptr_t>(page) / PAGE_SIZE].refs, __ATOMIC_ACQUIRE) + 1;
+    }
+
+    cache_stats_t get_cache_stats(uint32_t cpu) {
+        if (cpu >= SPHYNX_MAX_CPUS) {
+            return {};
+        }
+        return cpuCaches[cpu].stats;
     }
 
     void* request_pages(uint64_t pageCount) {
-        return nullptr;
+        if (pageCount == 0) {
+            return nullptr;
+        }
+
+        if (pageCount == 1) {
+            void* page = cache_alloc();
+            if (page == nullptr && reclaim(1) != 0) {
+                page = cache_alloc();
+            }
+            ALLOC_PROFILE_ALLOC(page, PAGE_SIZE, AllocProfile::SOURCE_PMM);
+            TRACEPOINT(pmm_alloc, "pmm alloc 1 page -> %p", page);
+            return page;
+        }
+
+        uint8_t order = order_for(pageCount);
+        if (order >= MAX_ORDER) {
+            return nullptr;
+        }
+
+        uint64_t pfn = alloc_or_reclaim(order, ZONE_NORMAL);
+
+        void* ptr = pfn == 0 ? nullptr : reinterpret_cast<void*>(pfn * PAGE_SIZE);
+        ALLOC_PROFILE_ALLOC(ptr, pageCount * PAGE_SIZE, AllocProfile::SOURCE_PMM);
+        TRACEPOINT(pmm_alloc, "pmm alloc %llu pages -> %p", pageCount, ptr);
+        return ptr;
+    }
+
+    void* request_pages_zone(uint64_t pageCount, Zone zone) {
+        uint8_t order = order_for(pageCount);
+        if (pageCount == 0 || order >= MAX_ORDER || zone >= ZONE_COUNT) {
+            return nullptr;
+        }
+
+        uint64_t pfn = alloc_or_reclaim(order, zone);
+
+        void* ptr = pfn == 0 ? nullptr : reinterpret_cast<void*>(pfn * PAGE_SIZE);
+        ALLOC_PROFILE_ALLOC(ptr, pageCount * PAGE_SIZE, AllocProfile::SOURCE_PMM);
+        return ptr;
+    }
+
+    void* request_pages_aligned(uint64_t pageCount, uint64_t alignment) {
+        if (pageCount == 0 || alignment == 0 || (alignment & (alignment - 1))) {
+            return nullptr;
+        }
+
+        // Buddy blocks are naturally aligned to their own size
+        uint8_t order = MAX(order_for(pageCount), order_for(DIV_ROUNDUP(alignment, PAGE_SIZE)));
+        if (order >= MAX_ORDER) {
+            return nullptr;
+        }
+
+        uint64_t pfn = alloc_or_reclaim(order, ZONE_NORMAL);
+
+        void* ptr = pfn == 0 ? nullptr : reinterpret_cast<void*>(pfn * PAGE_SIZE);
+        ALLOC_PROFILE_ALLOC(ptr, pageCount * PAGE_SIZE, AllocProfile::SOURCE_PMM);
+        return ptr;
+    }
+
+    void* request_huge_page() {
+        void* ptr = request_pages_aligned(HUGE_PAGE_SIZE / PAGE_SIZE, HUGE_PAGE_SIZE);
+        ALLOC_PROFILE_ALLOC(ptr, HUGE_PAGE_SIZE, AllocProfile::SOURCE_PMM);
+        return ptr;
     }
 
     void free_pages(void* ptr) {
-        
+        if (ptr == nullptr) {
+            return;
+        }
+
+        uint64_t pfn = reinterpret_cast<uintptr_t>(ptr) / PAGE_SIZE;
+        if ((reinterpret_cast<uintptr_t>(ptr) & (PAGE_SIZE - 1)) || !is_allocated(pfn)) {
+            kpanic(nullptr, "PMM: free of a block that was never allocated");
+        }
+        ALLOC_PROFILE_FREE(ptr, AllocProfile::SOURCE_PMM);
+        TRACEPOINT(pmm_free, "pmm free %p", ptr);
+
+        // DMA pages never enter the caches so they can't leak into ordinary allocations
+        if ((pages[pfn].flags & PAGE_ORDER_MASK) == 0 && zone_of(pfn) != &zones[ZONE_DMA]) {
+            cache_free(pfn);
+            return;
+        }
+
+        lock.lock();
+        free_block(pfn, pages[pfn].flags & PAGE_ORDER_MASK);
+        lock.unlock();
+    }
+
+    void self_test() {
+        Logger logger("PMM");
+        const uint64_t batch = 64;
+        const uint64_t rounds = 64;
+        void* ptrs[batch];
+        uint64_t before = get_free();
+
+        uint64_t start = TSC::read();
+        for (uint64_t round = 0; round < rounds; round++) {
+            for (uint64_t i = 0; i < batch; i++) {
+                ptrs[i] = request_pages(1);
+                if (ptrs[i] == nullptr) {
+                    kpanic(nullptr, "PMM self test: out of memory");
+                }
+                *static_cast<uint64_t*>(ptrs[i]) = i;
+            }
+
+            for (uint64_t i = 0; i < batch; i++) {
+                if (*static_cast<uint64_t*>(ptrs[i]) != i) {
+                    kpanic(nullptr, "PMM self test: overlapping allocations");
+                }
+                free_pages(ptrs[i]);
+            }
+        }
+        uint64_t singleNs = TSC::ticks_to_ns(TSC::read() - start);
+
+        start = TSC::read();
+        for (uint64_t round = 0; round < rounds; round++) {
+            for (uint64_t i = 0; i < batch; i++) {
+                ptrs[i] = request_pages(1ull << (i % (MAX_ORDER - 1)));
+                if (ptrs[i] == nullptr) {
+                    kpanic(nullptr, "PMM self test: out of memory");
+                }
+            }
+
+            for (uint64_t i = 0; i < batch; i++) {
+                free_pages(ptrs[batch - i - 1]);
+            }
+        }
+        uint64_t mixedNs = TSC::ticks_to_ns(TSC::read() - start);
+
+        void* huge = request_huge_page();
+        if (huge != nullptr && (reinterpret_cast<uintptr_t>(huge) & (HUGE_PAGE_SIZE - 1))) {
+            kpanic(nullptr, "PMM self test: misaligned huge page");
+        }
+        free_pages(huge);
+
+        void* low = request_pages_zone(4, ZONE_DMA32);
+        if (low != nullptr && reinterpret_cast<uintptr_t>(low) + 4 * PAGE_SIZE > ZONE_DMA32_END) {
+            kpanic(nullptr, "PMM self test: DMA32 allocation above 4 GiB");
+        }
+        free_pages(low);
+
+        // Free a lower buddy and then its upper half, the upper one merges down and must no longer pass as allocated
+        void* pairs[batch];
+        bool merged = false;
+        for (uint64_t i = 0; i < batch; i++) {
+            pairs[i] = request_pages(2);
+            uint64_t pfn = pairs[i] ? reinterpret_cast<uintptr_t>(pairs[i]) / PAGE_SIZE : 0;
+            for (uint64_t j = 0; pfn && !merged && j < i; j++) {
+                uint64_t other = pairs[j] ? reinterpret_cast<uintptr_t>(pairs[j]) / PAGE_SIZE : 0;
+                if (other && (pfn ^ 2) == other && pfn > other) {
+                    free_pages(pairs[j]);
+                    free_pages(pairs[i]);
+                    if (is_allocated(pfn)) {
+                        kpanic(nullptr, "PMM self test: double free of a merged upper buddy goes unnoticed");
+                    }
+                    pairs[i] = pairs[j] = nullptr;
+                    merged = true;
+                }
+            }
+        }
+        for (uint64_t i = 0; i < batch; i++) {
+            free_pages(pairs[i]);
+        }
+        if (!merged) {
+            logger.log(Logger::Level::WARN, "Self test found no buddy pair to double free\n");
+        }
+
+        if (get_free() != before) {
+            kpanic(nullptr, "PMM self test: free page count drifted");
+        }
+
+        uint64_t total = batch * rounds;
+        cache_stats_t stats = get_cache_stats(PerCPU::id());
+        logger.log(Logger::Level::INFO, "Single page: %llu allocs/s, mixed orders: %llu allocs/s\n",
+            singleNs ? total * 1000000000ull / singleNs : 0,
+            mixedNs ? total * 1000000000ull / mixedNs : 0);
+        logger.log(Logger::Level::INFO, "Page cache: %llu hits, %llu misses, %llu refills, %llu drains\n",
+            stats.hits, stats.misses, stats.refills, stats.drains);
     }
 }
@@ -0,0 +1,248 @@
+/*
+Sphynx Operating System
+
+File: profile.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Allocation profiler for the heap and PMM
+*/
+
+#include <core/mm/profile.hpp>
+
+#if SPHYNX_ALLOC_PROFILE
+
+#include <sys/cpu.hpp>
+#include <sys/tsc.hpp>
+#include <sys/spinlock.hpp>
+#include <dev/tty.hpp>
+
+namespace AllocProfile {
+    // Both tables are open addressed with linear probing, sizes must be powers of two
+    #define PROFILE_MAX_SITES 1024
+    #define PROFILE_MAX_LIVE 16384
+
+    typedef struct {
+        void* site;
+        uint64_t allocs;
+        uint64_t frees;
+        uint64_t liveBytes;
+        uint64_t liveCount;
+        uint64_t totalBytes;
+        uint8_t source;
+    } site_t;
+
+    typedef struct {
+        void* ptr;
+        uint64_t size;
+        uint32_t site;
+        uint8_t source;
+    } live_t;
+
+    static site_t sites[PROFILE_MAX_SITES];
+    static live_t live[PROFILE_MAX_LIVE];
+    static uint64_t liveUsed = 0;
+    // Events lost because a table was full, the report is incomplete when these are non zero
+    static uint64_t droppedSites = 0;
+    static uint64_t droppedLive = 0;
+    static uint64_t startNs = 0;
+    static Spinlock lock;
+
+    static inline uint64_t hash(const void* key, uint8_t source) {
+        uint64_t x = reinterpret_cast<uint64_t>(key) ^ source;
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDull;
+        x ^= x >> 33;
+        return x;
+    }
+
+    static site_t* find_site(void* site, uint8_t source) {
+        uint64_t i = hash(site, source) & (PROFILE_MAX_SITES - 1);
+        for (uint64_t probe = 0; probe < PROFILE_MAX_SITES; probe++) {
+            site_t* entry = &sites[i];
+            if (entry->site == site && entry->source == source) {
+                return entry;
+            }
+            if (entry->site == nullptr) {
+                entry->site = site;
+                entry->source = source;
+                return entry;
+            }
+            i = (i + 1) & (PROFILE_MAX_SITES - 1);
+        }
+        droppedSites++;
+        return nullptr;
+    }
+
+    static live_t* find_live(void* ptr, uint8_t source) {
+        uint64_t i = hash(ptr, source) & (PROFILE_MAX_LIVE - 1);
+        while (live[i].ptr != nullptr) {
+            if (live[i].ptr == ptr && live[i].source == source) {
+                return &live[i];
+            }
+            i = (i + 1) & (PROFILE_MAX_LIVE - 1);
+        }
+        return nullptr;
+    }
+
+    // Backward shift deletion keeps probe chains intact without tombstones
+    static void remove_live(live_t* entry) {
+        uint64_t hole = entry - live;
+        uint64_t i = hole;
+        while (true) {
+            i = (i + 1) & (PROFILE_MAX_LIVE - 1);
+            if (live[i].ptr == nullptr) {
+                break;
+            }
+            uint64_t home = hash(live[i].ptr, live[i].source) & (PROFILE_MAX_LIVE - 1);
+            // Move the entry back when its home slot is not between the hole and its current slot
+            if (((i - home) & (PROFILE_MAX_LIVE - 1)) >= ((i - hole) & (PROFILE_MAX_LIVE - 1))) {
+                live[hole] = live[i];
+                hole = i;
+            }
+        }
+        live[hole].ptr = nullptr;
+        liveUsed--;
+    }
+
+    static void forget(live_t* entry) {
+        site_t* owner = &sites[entry->site];
+        owner->liveBytes -= entry->size;
+        owner->liveCount--;
+    }
+
+    void record_alloc(void* site, void* ptr, uint64_t size, Source source) {
+        if (ptr == nullptr) {
+            return;
+        }
+
+        uint64_t flags = irq_save();
+        lock.lock();
+        if (startNs == 0) {
+            startNs = TSC::get_ns();
+        }
+
+        live_t* entry = find_live(ptr, source);
+        if (entry) {
+            // An inner allocator call already recorded this block, hand it to the outer caller
+            site_t* inner = &sites[entry->site];
+            forget(entry);
+            inner->allocs--;
+            inner->totalBytes -= entry->size;
+            remove_live(entry);
+        }
+
+        site_t* owner = find_site(site, source);
+        if (owner) {
+            owner->allocs++;
+            owner->totalBytes += size;
+            owner->liveBytes += size;
+            owner->liveCount++;
+
+            // Keep the table at most 3/4 full so probes stay short
+            if (liveUsed < PROFILE_MAX_LIVE / 4 * 3) {
+                uint64_t i = hash(ptr, source) & (PROFILE_MAX_LIVE - 1);
+                while (live[i].ptr != nullptr) {
+                    i = (i + 1) & (PROFILE_MAX_LIVE - 1);
+                }
+                live[i] = { ptr, size, static_cast<uint32_t>(owner - sites), static_cast<uint8_t>(source) };
+                liveUsed++;
+            } else {
+                // Untracked blocks can never be freed from the site, so don't count them as live
+                owner->liveBytes -= size;
+                owner->liveCount--;
+                droppedLive++;
+            }
+        }
+        lock.unlock();
+        irq_restore(flags);
+    }
+
+    void record_free(void* ptr, Source source) {
+        if (ptr == nullptr) {
+            return;
+        }
+
+        uint64_t flags = irq_save();
+        lock.lock();
+        live_t* entry = find_live(ptr, source);
+        if (entry) {
+            sites[entry->site].frees++;
+            forget(entry);
+            remove_live(entry);
+        }
+        lock.unlock();
+        irq_restore(flags);
+    }
+
+    void report(uint32_t count) {
+        static const char* sourceNames[SOURCE_COUNT] = { "heap", "pmm" };
+
+        uint64_t flags = irq_save();
+        lock.lock();
+        uint64_t elapsedNs = TSC::get_ns() - startNs;
+        if (elapsedNs == 0) {
+            elapsedNs = 1;
+        }
+
+        kdprintf("Allocation profile, top %u sites by live bytes over %llu ms\n", count, elapsedNs / 1000000);
+        kdprintf("%-4s %-18s %-12s %-10s %-10s %-10s %-10s\n", "src", "site", "live bytes", "live", "allocs", "frees", "allocs/s");
+
+        // Selection by repeated scans, the table is small and this only runs on demand
+        uint64_t lastBytes = ~0ull;
+        uint64_t lastIndex = PROFILE_MAX_SITES;
+        for (uint32_t n = 0; n < count; n++) {
+            site_t* best = nullptr;
+            for (uint64_t i = 0; i < PROFILE_MAX_SITES; i++) {
+                site_t* site = &sites[i];
+                // Sites whose every block was handed on to an outer caller have nothing to show
+                if (site->site == nullptr || site->allocs == 0) {
+                    continue;
+                }
+                // Strictly after the previous pick in (bytes desc, index asc) order
+                if (site->liveBytes > lastBytes || (site->liveBytes == lastBytes && i <= lastIndex)) {
+                    continue;
+                }
+                if (!best || site->liveBytes > best->liveBytes) {
+                    best = site;
+                }
+            }
+            if (!best) {
+                break;
+            }
+
+            kdprintf("%-4s %-18p %-12llu %-10llu %-10llu %-10llu %-10llu\n", sourceNames[best->source], best->site,
+                best->liveBytes, best->liveCount, best->allocs, best->frees, best->allocs * 1000000000ull / elapsedNs);
+            lastBytes = best->liveBytes;
+            lastIndex = best - sites;
+        }
+
+        if (droppedSites || droppedLive) {
+            kdprintf("Profile tables overflowed, %llu events without a site and %llu untracked blocks\n", droppedSites, droppedLive);
+        }
+        lock.unlock();
+        irq_restore(flags);
+    }
+}
+
+#endif
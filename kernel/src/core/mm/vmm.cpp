@@ -0,0 +1,748 @@
+/*
+Sphynx Operating System
+
+File: vmm.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Sphynx virtual memory manager
+*/
+
+#include <core/mm/vmm.hpp>
+#include <core/mm/pmm.hpp>
+#include <core/mm/early.hpp>
+#include <math_utils.hpp>
+#include <dev/tty.hpp>
+#include <sys/cpu.hpp>
+#include <sys/percpu.hpp>
+#include <string.hpp>
+
+extern "C" char __text_start[], __text_end[];
+extern "C" char __rodata_start[], __rodata_end[];
+extern "C" char __data_start[], _end[];
+
+namespace VMM {
+    #define GIB 0x40000000ull
+    #define MSR_EFER 0xC0000080
+    #define EFER_NXE (1ull << 11)
+    #define CR0_WP (1ull << 16)
+    #define CR4_PCIDE (1ull << 17)
+    #define CR3_NOFLUSH (1ull << 63)
+    #define PCID_COUNT 4096
+
+    #define PF_PRESENT (1 << 0)
+    #define PF_WRITE (1 << 1)
+    #define PF_RESERVED (1 << 3)
+
+    static address_space_t kernelSpace;
+    static address_space_t* currentSpaces[SPHYNX_MAX_CPUS];
+
+    // Page tables are reached through the identity map until our own tables with the direct map are loaded
+    static uint64_t hhdmBase = 0;
+    static uint64_t pteMask = ~0ull;
+    static bool gigPages = false;
+    static bool pcidEnabled = false;
+    static bool invpcidSupported = false;
+
+    static fault_stats_t faultStats;
+
+    static Spinlock pcidLock;
+    static uint16_t nextPcid = 1;
+    static uint64_t pcidGeneration = 1;
+
+    static inline uint64_t* table_at(uint64_t phys) {
+        return reinterpret_cast<uint64_t*>(phys + hhdmBase);
+    }
+
+    static inline uint64_t index_of(uint64_t virt, int level) {
+        return (virt >> (12 + 9 * (level - 1))) & 0x1FF;
+    }
+
+    static inline uint64_t level_size(int level) {
+        return 1ull << (12 + 9 * (level - 1));
+    }
+
+    static inline bool is_user(uint64_t virt) {
+        return (virt >> 63) == 0;
+    }
+
+    static uint64_t alloc_table() {
+        return reinterpret_cast<uint64_t>(PMM::request_zeroed_pages(1));
+    }
+
+    // Every PCID's entries go, global ones included
+    static void flush_all_contexts() {
+        if (invpcidSupported) {
+            invpcid(INVPCID_ALL_CONTEXTS, 0, 0);
+            return;
+        }
+        uint64_t flags = irq_save();
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+        irq_restore(flags);
+    }
+
+    static void flush_page(address_space_t* space, uint64_t virt) {
+        // Kernel tables are shared by every space, and with PCIDs each space caches their non global entries under
+        // its own tag, which invlpg only drops for the loaded one
+        if (space == &kernelSpace) {
+            if (pcidEnabled) {
+                flush_all_contexts();
+            } else {
+                invlpg(virt);
+            }
+        } else if (currentSpaces[PerCPU::id()] == space) {
+            invlpg(virt);
+        } else {
+            space->tlbStale = true;
+        }
+    }
+
+    // Replaces a 1 GiB or 2 MiB leaf with a table of the next smaller pages covering the same range
+    static bool split(uint64_t* entry, int level) {
+        uint64_t old = *entry;
+        uint64_t table = alloc_table();
+        if (table == 0) {
+            return false;
+        }
+
+        uint64_t base = old & PTE_ADDR_MASK & ~(level_size(level) - 1);
+        uint64_t flags = (old & 0xFFFull & ~PTE_HUGE) | (old & PTE_NX);
+        uint64_t step = level_size(level - 1);
+
+        // The PAT bit lives at bit 12 in large pages and bit 7 in 4 KiB pages
+        if (level == 3) {
+            flags |= PTE_HUGE | (old & PTE_PAT_HUGE);
+        } else if (old & PTE_PAT_HUGE) {
+            flags |= PTE_PAT_4K;
+        }
+
+        uint64_t* entries = table_at(table);
+        for (uint64_t i = 0; i < 512; i++) {
+            entries[i] = (base + i * step) | flags;
+        }
+
+        *entry = table | PTE_PRESENT | PTE_WRITABLE | (old & PTE_USER);
+        return true;
+    }
+
+    // Walks down to the entry for virt at the target level (1 = PT, 2 = PD, 3 = PDPT), splitting large pages on the way
+    static uint64_t* walk(address_space_t* space, uint64_t virt, int target, bool create) {
+        uint64_t* table = table_at(space->pml4);
+        for (int level = 4; level > target; level--) {
+            uint64_t* entry = &table[index_of(virt, level)];
+            if (!(*entry & PTE_PRESENT)) {
+                if (!create) {
+                    return nullptr;
+                }
+
+                uint64_t next = alloc_table();
+                if (next == 0) {
+                    return nullptr;
+                }
+                *entry = next | PTE_PRESENT | PTE_WRITABLE | (is_user(virt) ? PTE_USER : 0);
+            } else if (level <= 3 && (*entry & PTE_HUGE)) {
+                if (!split(entry, level)) {
+                    return nullptr;
+                }
+            }
+
+            table = table_at(*entry & PTE_ADDR_MASK);
+        }
+
+        return &table[index_of(virt, target)];
+    }
+
+    // Kernel owned PML4 slots are shared with every space and can only be changed through the kernel space
+    bool is_shared(address_space_t* space, uint64_t virt) {
+        if (space == &kernelSpace) {
+            return false;
+        }
+        return table_at(kernelSpace.pml4)[index_of(virt, 4)] & PTE_PRESENT;
+    }
+
+    static bool map_huge(address_space_t* space, uint64_t virt, uint64_t phys, int level, uint64_t flags) {
+        space->lock.lock();
+        uint64_t* entry = walk(space, virt, level, true);
+        if (entry == nullptr || ((*entry & PTE_PRESENT) && !(*entry & PTE_HUGE))) {
+            space->lock.unlock();
+            return false;
+        }
+
+        if (flags & PTE_PAT_4K) {
+            flags = (flags & ~PTE_PAT_4K) | PTE_PAT_HUGE;
+        }
+
+        uint64_t old = *entry;
+        *entry = phys | ((flags | PTE_PRESENT | PTE_HUGE) & pteMask);
+        if (old & PTE_PRESENT) {
+            flush_page(space, virt);
+        }
+        space->lock.unlock();
+        return true;
+    }
+
+    bool map(address_space_t* space, uint64_t virt, uint64_t phys, uint64_t flags) {
+        if (is_shared(space, virt)) {
+            return false;
+        }
+
+        space->lock.lock();
+        uint64_t* pte = walk(space, virt, 1, true);
+        if (pte == nullptr) {
+            space->lock.unlock();
+            return false;
+        }
+
+        uint64_t old = *pte;
+        *pte = (phys & PTE_ADDR_MASK) | ((flags | PTE_PRESENT) & pteMask);
+        if (old & PTE_PRESENT) {
+            flush_page(space, virt);
+        }
+        space->lock.unlock();
+        return true;
+    }
+
+    bool map_range(address_space_t* space, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags) {
+        if (is_shared(space, virt)) {
+            return false;
+        }
+
+        uint64_t end = virt + ALIGN_UP(size, PAGE_SIZE);
+        while (virt < end) {
+            uint64_t left = end - virt;
+            if (gigPages && ((virt | phys) & (GIB - 1)) == 0 && left >= GIB && map_huge(space, virt, phys, 3, flags)) {
+                virt += GIB;
+                phys += GIB;
+                continue;
+            }
+
+            if (((virt | phys) & (HUGE_PAGE_SIZE - 1)) == 0 && left >= HUGE_PAGE_SIZE && map_huge(space, virt, phys, 2, flags)) {
+                virt += HUGE_PAGE_SIZE;
+                phys += HUGE_PAGE_SIZE;
+                continue;
+            }
+
+            if (!map(space, virt, phys, flags)) {
+                return false;
+            }
+            virt += PAGE_SIZE;
+            phys += PAGE_SIZE;
+        }
+
+        return true;
+    }
+
+    bool map_phys(address_space_t* space, uint64_t virt, uint64_t phys, uint64_t size, uint64_t flags, MemType::Type type) {
+        flags &= ~(PTE_PWT | PTE_PCD | PTE_PAT_4K);
+        return map_range(space, virt, phys, size, flags | MemType::pte_flags(type));
+    }
+
+    void unmap(address_space_t* space, uint64_t virt) {
+        if (is_shared(space, virt)) {
+            return;
+        }
+
+        space->lock.lock();
+        uint64_t* pte = walk(space, virt, 1, false);
+        if (pte != nullptr && (*pte & PTE_PRESENT)) {
+            uint64_t old = *pte;
+            *pte = 0;
+            flush_page(space, virt);
+            if (old & PTE_OWNED) {
+                PMM::page_put(reinterpret_cast<void*>(old & PTE_ADDR_MASK));
+            }
+        }
+        space->lock.unlock();
+    }
+
+    bool protect(address_space_t* space, uint64_t virt, uint64_t flags) {
+        if (is_shared(space, virt)) {
+            return false;
+        }
+
+        space->lock.lock();
+        uint64_t* pte = walk(space, virt, 1, false);
+        if (pte == nullptr || !(*pte & PTE_PRESENT)) {
+            space->lock.unlock();
+            return false;
+        }
+
+        // A shared copy-on-write page stays read-only, COW itself only survives if the page is meant to be writable
+        if ((*pte & PTE_COW) && (flags & PTE_WRITABLE)) {
+            flags = (flags & ~PTE_WRITABLE) | PTE_COW;
+        }
+
+        *pte = (*pte & (PTE_ADDR_MASK | PTE_OWNED)) | ((flags | PTE_PRESENT) & pteMask);
+        flush_page(space, virt);
+        space->lock.unlock();
+        return true;
+    }
+
+    uint64_t translate(address_space_t* space, uint64_t virt) {
+        uint64_t* table = table_at(space->pml4);
+        for (int level = 4; level > 0; level--) {
+            uint64_t entry = table[index_of(virt, level)];
+            if (!(entry & PTE_PRESENT)) {
+                return 0;
+            }
+
+            if (level == 1 || (level <= 3 && (entry & PTE_HUGE))) {
+                uint64_t size = level_size(level);
+                return (entry & PTE_ADDR_MASK & ~(size - 1)) + (virt & (size - 1));
+            }
+
+            table = table_at(entry & PTE_ADDR_MASK);
+        }
+
+        return 0;
+    }
+
+    address_space_t* kernel_space() {
+        return &kernelSpace;
+    }
+
+    address_space_t* create_space() {
+        static_assert(sizeof(address_space_t) <= PAGE_SIZE, "address spaces live in a single page");
+
+        address_space_t* space = static_cast<address_space_t*>(PMM::request_zeroed_pages(1));
+        if (space == nullptr) {
+            return nullptr;
+        }
+
+        space->pml4 = alloc_table();
+        if (space->pml4 == 0) {
+            PMM::free_pages(space);
+            return nullptr;
+        }
+
+        // Every slot the kernel uses is shared, this includes the identity map in the lower half for now
+        uint64_t* kernelPml4 = table_at(kernelSpace.pml4);
+        uint64_t* pml4 = table_at(space->pml4);
+        for (int i = 0; i < 512; i++) {
+            pml4[i] = kernelPml4[i];
+        }
+
+        return space;
+    }
+
+    static void free_table(uint64_t phys, int level) {
+        uint64_t* table = table_at(phys);
+        for (int i = 0; i < 512; i++) {
+            if (!(table[i] & PTE_PRESENT)) {
+                continue;
+            }
+
+            if (level > 1 && !(level <= 3 && (table[i] & PTE_HUGE))) {
+                free_table(table[i] & PTE_ADDR_MASK, level - 1);
+            } else if (table[i] & PTE_OWNED) {
+                PMM::page_put(reinterpret_cast<void*>(table[i] & PTE_ADDR_MASK));
+            }
+        }
+        PMM::free_pages(reinterpret_cast<void*>(phys));
+    }
+
+    void destroy_space(address_space_t* space) {
+        if (space == nullptr || space == &kernelSpace) {
+            return;
+        }
+
+        uint64_t* kernelPml4 = table_at(kernelSpace.pml4);
+        uint64_t* pml4 = table_at(space->pml4);
+        for (int i = 0; i < 512; i++) {
+            if ((pml4[i] & PTE_PRESENT) && !(kernelPml4[i] & PTE_PRESENT)) {
+                free_table(pml4[i] & PTE_ADDR_MASK, 3);
+            }
+        }
+
+        PMM::free_pages(reinterpret_cast<void*>(space->pml4));
+        PMM::free_pages(space);
+    }
+
+    // Drops every non global translation of a space
+    static void flush_space(address_space_t* space) {
+        if (currentSpaces[PerCPU::id()] == space) {
+            space->tlbStale = true;
+            switch_to(space);
+        } else {
+            space->tlbStale = true;
+        }
+    }
+
+    // Copies a table, owned pages get shared with an extra reference and lose write access until the next write fault
+    static bool clone_table(uint64_t* src, uint64_t* dst, int level) {
+        for (int i = 0; i < 512; i++) {
+            uint64_t entry = src[i];
+            if (!(entry & PTE_PRESENT)) {
+                continue;
+            }
+
+            if (level > 1 && !(level <= 3 && (entry & PTE_HUGE))) {
+                uint64_t table = alloc_table();
+                if (table == 0) {
+                    return false;
+                }
+
+                dst[i] = table | (entry & ~PTE_ADDR_MASK);
+                if (!clone_table(table_at(entry & PTE_ADDR_MASK), table_at(table), level - 1)) {
+                    return false;
+                }
+                continue;
+            }
+
+            if (entry & PTE_OWNED) {
+                if (entry & PTE_WRITABLE) {
+                    entry = (entry & ~PTE_WRITABLE) | PTE_COW;
+                    src[i] = entry;
+                }
+                PMM::page_get(reinterpret_cast<void*>(entry & PTE_ADDR_MASK));
+            }
+            dst[i] = entry;
+        }
+
+        return true;
+    }
+
+    address_space_t* clone(address_space_t* space) {
+        if (space == &kernelSpace) {
+            return nullptr;
+        }
+
+        address_space_t* copy = create_space();
+        if (copy == nullptr) {
+            return nullptr;
+        }
+
+        space->lock.lock();
+        uint64_t* kernelPml4 = table_at(kernelSpace.pml4);
+        uint64_t* src = table_at(space->pml4);
+        uint64_t* dst = table_at(copy->pml4);
+        bool ok = true;
+
+        for (int i = 0; i < 512 && ok; i++) {
+            if (!(src[i] & PTE_PRESENT) || (kernelPml4[i] & PTE_PRESENT)) {
+                continue;
+            }
+
+            uint64_t table = alloc_table();
+            if (table == 0) {
+                ok = false;
+                break;
+            }
+
+            dst[i] = table | (src[i] & ~PTE_ADDR_MASK);
+            ok = clone_table(table_at(src[i] & PTE_ADDR_MASK), table_at(table), 3);
+        }
+
+        copy->regionCount = space->regionCount;
+        memcpy(copy->regions, space->regions, sizeof(space->regions));
+        space->lock.unlock();
+
+        // The source lost write access to its private pages
+        flush_space(space);
+
+        if (!ok) {
+            destroy_space(copy);
+            return nullptr;
+        }
+        return copy;
+    }
+
+    static region_t* find_region(address_space_t* space, uint64_t addr) {
+        for (uint64_t i = 0; i < space->regionCount; i++) {
+            if (addr >= space->regions[i].base && addr < space->regions[i].end) {
+                return &space->regions[i];
+            }
+        }
+        return nullptr;
+    }
+
+    bool reserve(address_space_t* space, uint64_t virt, uint64_t size, uint64_t flags) {
+        uint64_t base = ALIGN_DOWN(virt, PAGE_SIZE);
+        uint64_t end = ALIGN_UP(virt + size, PAGE_SIZE);
+        if (size == 0 || is_shared(space, base)) {
+            return false;
+        }
+
+        space->lock.lock();
+        for (uint64_t i = 0; i < space->regionCount; i++) {
+            if (base < space->regions[i].end && end > space->regions[i].base) {
+                space->lock.unlock();
+                return false;
+            }
+        }
+
+        if (space->regionCount == VMM_MAX_REGIONS) {
+            space->lock.unlock();
+            return false;
+        }
+
+        space->regions[space->regionCount++] = { base, end, flags };
+        space->lock.unlock();
+        return true;
+    }
+
+    void release(address_space_t* space, uint64_t virt) {
+        space->lock.lock();
+        region_t* region = find_region(space, virt);
+        if (region == nullptr || region->base != virt) {
+            space->lock.unlock();
+            return;
+        }
+
+        region_t copy = *region;
+        *region = space->regions[--space->regionCount];
+        space->lock.unlock();
+
+        for (uint64_t addr = copy.base; addr < copy.end; addr += PAGE_SIZE) {
+            unmap(space, addr);
+        }
+    }
+
+    // Caller holds the space lock
+    static bool resolve_cow(address_space_t* space, uint64_t* pte, uint64_t page) {
+        void* old = reinterpret_cast<void*>(*pte & PTE_ADDR_MASK);
+        uint64_t flags = (*pte & ~(PTE_ADDR_MASK | PTE_COW)) | PTE_WRITABLE;
+
+        // Last one holding the page can simply take it back
+        if (PMM::page_count(old) == 1) {
+            *pte = reinterpret_cast<uint64_t>(old) | flags;
+            invlpg(page);
+            return true;
+        }
+
+        void* copy = PMM::request_pages(1);
+        if (copy == nullptr) {
+            return false;
+        }
+
+        memcpy(phys_to_virt(reinterpret_cast<uint64_t>(copy)), phys_to_virt(reinterpret_cast<uint64_t>(old)), PAGE_SIZE);
+        *pte = reinterpret_cast<uint64_t>(copy) | flags;
+        invlpg(page);
+        PMM::page_put(old);
+        return true;
+    }
+
+    bool handle_fault(uint64_t addr, uint64_t err) {
+        address_space_t* space = currentSpaces[PerCPU::id()];
+        uint64_t page = ALIGN_DOWN(addr, PAGE_SIZE);
+
+        // Resolving needs the space and PMM locks, a fault from code already holding one would spin forever
+        if (MmLock::held_by_this_cpu()) {
+            kpanic(nullptr, "VMM: page fault while holding a memory management lock");
+        }
+
+        if (space == nullptr || (err & PF_RESERVED)) {
+            __atomic_fetch_add(&faultStats.fatal, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+
+        // Shared slots belong to the kernel space no matter which space is loaded
+        if (is_shared(space, page)) {
+            space = &kernelSpace;
+        }
+
+        space->lock.lock();
+        if ((err & PF_PRESENT) && (err & PF_WRITE)) {
+            uint64_t* pte = walk(space, page, 1, false);
+            if (pte != nullptr && (*pte & PTE_COW) && resolve_cow(space, pte, page)) {
+                space->lock.unlock();
+                __atomic_fetch_add(&faultStats.cow, 1, __ATOMIC_RELAXED);
+                return true;
+            }
+        } else if (!(err & PF_PRESENT)) {
+            region_t* region = find_region(space, addr);
+            void* frame = region != nullptr ? PMM::request_zeroed_pages(1) : nullptr;
+            uint64_t* pte = frame != nullptr ? walk(space, page, 1, true) : nullptr;
+
+            if (pte != nullptr) {
+                if (*pte & PTE_PRESENT) {
+                    PMM::free_pages(frame);
+                } else {
+                    *pte = reinterpret_cast<uint64_t>(frame) | ((region->flags | PTE_PRESENT | PTE_OWNED) & pteMask);
+                }
+                invlpg(page);
+                space->lock.unlock();
+                __atomic_fetch_add(&faultStats.minor, 1, __ATOMIC_RELAXED);
+                return true;
+            }
+
+            PMM::free_pages(frame);
+        }
+        space->lock.unlock();
+
+        __atomic_fetch_add(&faultStats.fatal, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    fault_stats_t get_fault_stats() {
+        return faultStats;
+    }
+
+    // Hands out PCIDs per generation, running out starts a new generation with a full flush
+    static void assign_pcid(address_space_t* space) {
+        pcidLock.lock();
+        if (nextPcid == PCID_COUNT) {
+            nextPcid = 1;
+            pcidGeneration++;
+
+            flush_all_contexts();
+        }
+
+        space->pcid = nextPcid++;
+        space->generation = pcidGeneration;
+        pcidLock.unlock();
+    }
+
+    void switch_to(address_space_t* space) {
+        uint64_t flags = irq_save();
+        uint64_t cr3 = space->pml4;
+
+        if (pcidEnabled) {
+            bool keep = !space->tlbStale;
+            if (space != &kernelSpace && space->generation != pcidGeneration) {
+                assign_pcid(space);
+                keep = false;
+            }
+
+            cr3 |= space->pcid;
+            if (keep) {
+                cr3 |= CR3_NOFLUSH;
+            }
+        }
+
+        space->tlbStale = false;
+        write_cr3(cr3);
+        currentSpaces[PerCPU::id()] = space;
+        irq_restore(flags);
+    }
+
+    static void map_section(uint64_t start, uint64_t end, uint64_t flags) {
+        for (uint64_t addr = ALIGN_DOWN(start, PAGE_SIZE); addr < end; addr += PAGE_SIZE) {
+            if (!map(&kernelSpace, addr, addr, flags)) {
+                kpanic(nullptr, "Failed to map the kernel image");
+            }
+        }
+    }
+
+    void init() {
+        Logger logger("VMM");
+        uint32_t eax, ebx, ecx, edx;
+
+        cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+        uint32_t maxLeaf = eax;
+
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        gigPages = edx & (1 << 26);
+        bool nx = edx & (1 << 20);
+
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        bool pcid = ecx & (1 << 17);
+        if (maxLeaf >= 7) {
+            cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+            invpcidSupported = ebx & (1 << 10);
+        }
+
+        // Before any table exists, so nothing is ever mapped under the firmware's PAT
+        MemType::init();
+
+        if (nx) {
+            wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+        } else {
+            pteMask &= ~PTE_NX;
+        }
+
+        kernelSpace.pml4 = alloc_table();
+        if (kernelSpace.pml4 == 0) {
+            kpanic(nullptr, "Failed to allocate the kernel PML4");
+        }
+
+        // Upper half PDPTs exist up front so every space created later sees new kernel mappings
+        uint64_t* pml4 = table_at(kernelSpace.pml4);
+        for (int i = 256; i < 512; i++) {
+            uint64_t table = alloc_table();
+            if (table == 0) {
+                kpanic(nullptr, "Failed to allocate the kernel PDPTs");
+            }
+            pml4[i] = table | PTE_PRESENT | PTE_WRITABLE;
+        }
+
+        // RAM gets write-back aliases, reserved ranges may be MMIO so they are mapped uncached and holes stay unmapped.
+        // Reserved ranges go first so a page shared with a RAM range ends up write-back
+        const Early::range_t* ranges = Early::get_ranges();
+        uint64_t ramBytes = 0, deviceBytes = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            for (uint64_t i = 0; i < Early::get_range_count(); i++) {
+                bool device = ranges[i].type == MEMMAP_RESERVED;
+                if (device != (pass == 0)) {
+                    continue;
+                }
+                uint64_t base = ALIGN_DOWN(ranges[i].base, PAGE_SIZE);
+                uint64_t size = ALIGN_UP(ranges[i].end, PAGE_SIZE) - base;
+                MemType::Type type = device ? MemType::UC : MemType::WB;
+
+                // The identity map is kept until bootloader handed pointers and the boot stack are moved over to
+                // the direct map
+                if (!map_phys(&kernelSpace, HHDM_OFFSET + base, base, size, PTE_WRITABLE | PTE_NX | PTE_GLOBAL, type) ||
+                    !map_phys(&kernelSpace, base, base, size, PTE_WRITABLE | PTE_NX | PTE_GLOBAL, type)) {
+                    kpanic(nullptr, "Failed to build the direct map");
+                }
+                *(device ? &deviceBytes : &ramBytes) += size;
+            }
+        }
+
+        uint64_t fbBase = ALIGN_DOWN(framebuffer->address, PAGE_SIZE);
+        uint64_t fbEnd = ALIGN_UP(framebuffer->address + framebuffer->pitch * framebuffer->height, PAGE_SIZE);
+        // Write-combining, and the direct map alias too since two aliases with different types aren't allowed
+        uint64_t fbFlags = PTE_WRITABLE | PTE_NX | PTE_GLOBAL;
+        if (!map_phys(&kernelSpace, fbBase, fbBase, fbEnd - fbBase, fbFlags, MemType::WC) ||
+            !map_phys(&kernelSpace, HHDM_OFFSET + fbBase, fbBase, fbEnd - fbBase, fbFlags, MemType::WC)) {
+            kpanic(nullptr, "Failed to map the framebuffer");
+        }
+
+        // Keep null pointer dereferences faulting
+        unmap(&kernelSpace, 0);
+
+        map_section(reinterpret_cast<uint64_t>(__text_start), reinterpret_cast<uint64_t>(__text_end), PTE_GLOBAL);
+        map_section(reinterpret_cast<uint64_t>(__rodata_start), reinterpret_cast<uint64_t>(__rodata_end), PTE_NX | PTE_GLOBAL);
+        map_section(reinterpret_cast<uint64_t>(__data_start), reinterpret_cast<uint64_t>(_end), PTE_WRITABLE | PTE_NX | PTE_GLOBAL);
+
+        write_cr0(read_cr0() | CR0_WP);
+        write_cr4(read_cr4() | CR4_PGE);
+        switch_to(&kernelSpace);
+        hhdmBase = HHDM_OFFSET;
+
+        // PCIDE can only be set while the loaded PCID is 0, which the kernel space always uses
+        if (pcid) {
+            write_cr4(read_cr4() | CR4_PCIDE);
+            pcidEnabled = true;
+        }
+
+        logger.log(Logger::Level::INFO, "Direct map of %llu MiB RAM and %llu MiB uncached with %s pages, NX %s, PCID %s\n",
+            ramBytes / 1024 / 1024, deviceBytes / 1024 / 1024, gigPages ? "1 GiB" : "2 MiB", nx ? "on" : "off",
+            pcidEnabled ? "on" : "off");
+        logger.log(Logger::Level::INFO, "Framebuffer mapped %s, MTRR type %s\n", MemType::has_pat() ? "WC" : "UC-",
+            MemType::name(MemType::mtrr_type(fbBase)));
+    }
+}
@@ -0,0 +1,108 @@
+/*
+Sphynx Operating System
+
+File: pic.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: 8259 programmable interrupt controller
+*/
+
+#include <core/pic.hpp>
+#include <dev/serial.hpp>
+
+namespace PIC {
+    #define MASTER_COMMAND 0x20
+    #define MASTER_DATA 0x21
+    #define SLAVE_COMMAND 0xA0
+    #define SLAVE_DATA 0xA1
+
+    #define ICW1_ICW4 0x01
+    #define ICW1_INIT 0x10
+    #define ICW4_8086 0x01
+    #define OCW3_READ_ISR 0x0B
+    #define CMD_EOI 0x20
+    #define CASCADE_IRQ 2
+
+    // Old PICs need a moment between init words, a write to the unused POST port provides it
+    static void io_wait() {
+        Serial::outb(0x80, 0);
+    }
+
+    void init() {
+        Serial::outb(MASTER_COMMAND, ICW1_INIT | ICW1_ICW4);
+        io_wait();
+        Serial::outb(SLAVE_COMMAND, ICW1_INIT | ICW1_ICW4);
+        io_wait();
+        Serial::outb(MASTER_DATA, PIC_VECTOR_BASE);
+        io_wait();
+        Serial::outb(SLAVE_DATA, PIC_VECTOR_BASE + 8);
+        io_wait();
+        Serial::outb(MASTER_DATA, 1 << CASCADE_IRQ);
+        io_wait();
+        Serial::outb(SLAVE_DATA, CASCADE_IRQ);
+        io_wait();
+        Serial::outb(MASTER_DATA, ICW4_8086);
+        io_wait();
+        Serial::outb(SLAVE_DATA, ICW4_8086);
+        io_wait();
+
+        // The cascade line stays open so unmasking a slave IRQ is enough to receive it
+        Serial::outb(MASTER_DATA, ~(1 << CASCADE_IRQ) & 0xFF);
+        Serial::outb(SLAVE_DATA, 0xFF);
+    }
+
+    void mask(uint8_t irq) {
+        uint16_t port = irq < 8 ? MASTER_DATA : SLAVE_DATA;
+        Serial::outb(port, Serial::inb(port) | (1 << (irq & 7)));
+    }
+
+    void unmask(uint8_t irq) {
+        uint16_t port = irq < 8 ? MASTER_DATA : SLAVE_DATA;
+        Serial::outb(port, Serial::inb(port) & ~(1 << (irq & 7)));
+    }
+
+    bool is_spurious(uint8_t irq) {
+        if (irq != 7 && irq != 15) {
+            return false;
+        }
+
+        uint16_t command = irq == 7 ? MASTER_COMMAND : SLAVE_COMMAND;
+        Serial::outb(command, OCW3_READ_ISR);
+        if (Serial::inb(command) & 0x80) {
+            return false;
+        }
+
+        if (irq == 15) {
+            Serial::outb(MASTER_COMMAND, CMD_EOI);
+        }
+        return true;
+    }
+
+    void eoi(uint8_t irq) {
+        if (irq >= 8) {
+            Serial::outb(SLAVE_COMMAND, CMD_EOI);
+        }
+        Serial::outb(MASTER_COMMAND, CMD_EOI);
+    }
+}
@@ -0,0 +1,223 @@
+/*
+Sphynx Operating System
+
+File: fbcon.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Framebuffer console rendered into a RAM back buffer
+*/
+
+#include <dev/fbcon.hpp>
+#include <sys/tsc.hpp>
+#include <core/mm/early.hpp>
+#include <core/mm/pmm.hpp>
+#include <math_utils.hpp>
+#include <string.hpp>
+#include <simd.hpp>
+
+namespace FBCon {
+    // Columns of a text row that changed since the last flush, in pixels. end == 0 means the row is clean
+    typedef struct {
+        uint32_t start;
+        uint32_t end;
+    } span_t;
+
+    #define FILL_PASSES 4
+
+    static struct flanterm_context* context = nullptr;
+    static struct flanterm_fb_context* fbCtx = nullptr;
+    static void (*render_char)(struct flanterm_context*, struct flanterm_fb_char*, size_t, size_t) = nullptr;
+    static uint8_t* screen = nullptr;
+    static uint8_t* back = nullptr;
+    static uint64_t pitch = 0;
+    static uint64_t height = 0;
+
+    static span_t* rows = nullptr;
+    static uint64_t rowCount = 0;
+    static bool allDirty = false;
+    static bool anyDirty = false;
+    static uint64_t lastFlush = 0;
+
+    static uint64_t renderTicks = 0;
+    static uint64_t flushTicks = 0;
+    static uint64_t flushes = 0;
+    static uint64_t bytesFlushed = 0;
+
+    // Every glyph flanterm draws comes through here, x and y are in cells
+    static void plot_char(struct flanterm_context* ctx, struct flanterm_fb_char* c, size_t x, size_t y) {
+        render_char(ctx, c, x, y);
+        if (y >= rowCount) {
+            allDirty = true;
+        } else {
+            uint32_t left = fbCtx->offset_x + x * fbCtx->glyph_width;
+            uint32_t right = left + fbCtx->glyph_width;
+            span_t* row = &rows[y];
+            if (row->end == 0) {
+                row->start = left;
+                row->end = right;
+            } else {
+                row->start = MIN(row->start, left);
+                row->end = MAX(row->end, right);
+            }
+        }
+        anyDirty = true;
+    }
+
+    struct flanterm_context* init(struct framebuffer* fb, uint32_t defaultBg, uint32_t defaultFg) {
+        screen = reinterpret_cast<uint8_t*>(fb->address);
+        pitch = fb->pitch;
+        height = fb->height;
+        #if SPHYNX_FB_BACK_BUFFER
+        back = static_cast<uint8_t*>(Early::alloc(pitch * height, PAGE_SIZE));
+        #else
+        back = screen;
+        #endif
+
+        struct flanterm_context* ctx = flanterm_fb_init(
+            Early::flanterm_alloc, Early::flanterm_free, reinterpret_cast<uint32_t*>(back),
+            fb->width, fb->height, fb->pitch,
+            fb->red_mask_size, fb->red_mask_shift, fb->green_mask_size,
+            fb->green_mask_shift, fb->blue_mask_size, fb->blue_mask_shift,
+            nullptr, nullptr, nullptr, &defaultBg,
+            &defaultFg, nullptr, nullptr, nullptr, 0, 0, 1, 1, 1, 0
+        );
+        if (!ctx) {
+            return nullptr;
+        }
+        ctx->cursor_enabled = false;
+        context = ctx;
+
+        if (back != screen) {
+            fbCtx = reinterpret_cast<struct flanterm_fb_context*>(ctx);
+            rowCount = ctx->rows;
+            rows = static_cast<span_t*>(Early::alloc(rowCount * sizeof(span_t)));
+            render_char = fbCtx->plot_char;
+            fbCtx->plot_char = plot_char;
+        }
+
+        // Paints the margins too, which no glyph covers
+        ctx->full_refresh(ctx);
+        allDirty = true;
+        anyDirty = true;
+        flush();
+        return ctx;
+    }
+
+    bool is_buffered() {
+        return back != screen;
+    }
+
+    void write(struct flanterm_context* ctx, const char* buffer, size_t length) {
+        uint64_t start = TSC::read();
+        flanterm_write(ctx, buffer, length);
+        uint64_t end = TSC::read();
+        renderTicks += end - start;
+
+        if (!anyDirty) {
+            return;
+        }
+        // Before calibration there is no clock to batch against, so every write goes out
+        uint64_t interval = TSC::get_frequency() / 1000000 * SPHYNX_FB_FLUSH_US;
+        if (end - lastFlush >= interval) {
+            flush();
+        }
+    }
+
+    void flush() {
+        if (!anyDirty || back == screen) {
+            return;
+        }
+        uint64_t start = TSC::read();
+        uint64_t bytes = 0;
+
+        if (allDirty) {
+            simd_memcpy(screen, back, pitch * height);
+            bytes = pitch * height;
+        } else {
+            uint64_t bytesPerPixel = fbCtx->bpp / 8;
+            for (uint64_t y = 0; y < rowCount; y++) {
+                span_t* row = &rows[y];
+                if (row->end == 0) {
+                    continue;
+                }
+                uint64_t top = fbCtx->offset_y + y * fbCtx->glyph_height;
+                uint64_t offset = row->start * bytesPerPixel;
+                uint64_t length = (row->end - row->start) * bytesPerPixel;
+                for (uint64_t line = top; line < top + fbCtx->glyph_height && line < height; line++) {
+                    memcpy(screen + line * pitch + offset, back + line * pitch + offset, length);
+                }
+                bytes += length * fbCtx->glyph_height;
+            }
+        }
+
+        if (rows) {
+            memset(rows, 0, rowCount * sizeof(span_t));
+        }
+        allDirty = false;
+        anyDirty = false;
+
+        uint64_t end = TSC::read();
+        lastFlush = end;
+        flushTicks += end - start;
+        flushes++;
+        bytesFlushed += bytes;
+    }
+
+    stats_t get_stats() {
+        stats_t stats;
+        stats.renderNs = TSC::ticks_to_ns(renderTicks);
+        stats.flushNs = TSC::ticks_to_ns(flushTicks);
+        stats.flushes = flushes;
+        stats.bytesFlushed = bytesFlushed;
+        return stats;
+    }
+
+    uint64_t measure_fill_rate() {
+        if (!context || TSC::get_frequency() == 0) {
+            return 0;
+        }
+
+        uint64_t words = pitch * height / sizeof(uint64_t);
+        volatile uint64_t* pixels = reinterpret_cast<volatile uint64_t*>(screen);
+        uint64_t start = TSC::read();
+        for (uint64_t pass = 0; pass < FILL_PASSES; pass++) {
+            uint64_t value = pass & 1 ? 0 : ~0ull;
+            for (uint64_t i = 0; i < words; i++) {
+                pixels[i] = value;
+            }
+        }
+        uint64_t ticks = TSC::read() - start;
+
+        if (back != screen) {
+            allDirty = true;
+            anyDirty = true;
+            flush();
+        } else {
+            context->full_refresh(context);
+        }
+
+        uint64_t bytes = words * sizeof(uint64_t) * FILL_PASSES;
+        return ticks == 0 ? 0 : bytes * TSC::get_frequency() / ticks / (1024 * 1024);
+    }
+}
@@ -0,0 +1,264 @@
+/*
+Sphynx Operating System
+
+File: klog.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Per CPU kernel log ring with deferred console output
+*/
+
+#include <dev/klog.hpp>
+#include <dev/tty.hpp>
+#include <sys/percpu.hpp>
+#include <sys/tsc.hpp>
+#include <core/mm/early.hpp>
+#include <string.hpp>
+#include <math_utils.hpp>
+#include <external/nanoprintf.h>
+
+namespace KLog {
+    // Records start on this alignment so a wrap filler always has room for its header
+    #define RECORD_ALIGN 32
+    #define LEVEL_FILLER 0xFF
+    #define PREFIX_MAX 128
+
+    typedef struct {
+        // Ring position plus one once the record is complete, stale bytes can never match it
+        uint64_t seq;
+        // Raw TSC, converted when printed
+        uint64_t timestamp;
+        uint32_t length;
+        uint8_t level;
+        uint8_t nameLength;
+        uint16_t textLength;
+        char data[];
+    } record_t;
+
+    static_assert(sizeof(record_t) <= RECORD_ALIGN, "record header must fit a filler slot");
+    static_assert((SPHYNX_LOG_RING_SIZE & (SPHYNX_LOG_RING_SIZE - 1)) == 0, "log ring size must be a power of two");
+
+    // Written only by its own CPU, possibly from nested interrupts, so space is claimed with a CAS on head.
+    // The single consumer advances tail once a record has been printed
+    typedef struct {
+        char* buffer;
+        uint64_t head;
+        uint64_t tail;
+        uint64_t dropped;
+        uint64_t records;
+    } ring_t;
+
+    static ring_t* rings[SPHYNX_MAX_CPUS];
+    // GS isn't usable before the first ring exists, so until then there's no CPU id to look up
+    static bool ready = false;
+    static bool draining = false;
+    static bool panicking = false;
+    static uint64_t flushes = 0;
+
+    static const char* colors[] = {
+        "\x1b[38;2;94;129;172m",
+        "\x1b[38;2;129;161;193m",
+        "\x1b[38;2;163;190;140m",
+        "\x1b[38;2;235;203;139m",
+        "\x1b[38;2;191;97;106m",
+    };
+
+    static const char* kinds[] = {
+        "DEBUG",
+        "INFO",
+        "OK",
+        "WARN",
+        "ERROR",
+    };
+
+    // The whole line goes out as one write, so sinks never see a record split up
+    static void emit(int level, const char* name, size_t nameLength, const char* text, size_t textLength, uint64_t timestamp) {
+        char line[PREFIX_MAX + KLOG_LINE_MAX + 4];
+        bool known = level >= 0 && level < static_cast<int>(sizeof(kinds) / sizeof(kinds[0]));
+        int length = npf_snprintf(line, PREFIX_MAX, "%s[%5llu.%06llu] [%-6s] [%-10.*s] ", known ? colors[level] : "\033[0m",
+            timestamp / 1000000000ull, (timestamp / 1000ull) % 1000000ull, known ? kinds[level] : "UNKNOWN", static_cast<int>(nameLength), name);
+        size_t used = length > 0 ? MIN(static_cast<size_t>(length), PREFIX_MAX - 1) : 0;
+        memcpy(line + used, text, textLength);
+        used += textLength;
+        memcpy(line + used, "\033[0m", 4);
+        used += 4;
+        Console::write(Console::SINK_PRINTF, level, line, used);
+    }
+
+    static inline record_t* record_at(ring_t* ring, uint64_t position) {
+        return reinterpret_cast<record_t*>(ring->buffer + (position & (SPHYNX_LOG_RING_SIZE - 1)));
+    }
+
+    void init_cpu() {
+        ring_t* ring = static_cast<ring_t*>(Early::alloc(sizeof(ring_t)));
+        ring->buffer = static_cast<char*>(Early::alloc(SPHYNX_LOG_RING_SIZE, RECORD_ALIGN));
+        __atomic_store_n(&rings[PerCPU::id()], ring, __ATOMIC_RELEASE);
+        __atomic_store_n(&ready, true, __ATOMIC_RELEASE);
+    }
+
+    // Claims length bytes, inserting a filler when the record would run past the end of the buffer
+    static record_t* reserve(ring_t* ring, uint32_t length, uint64_t* position) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        uint64_t filler;
+        while (true) {
+            uint64_t offset = head & (SPHYNX_LOG_RING_SIZE - 1);
+            filler = offset + length > SPHYNX_LOG_RING_SIZE ? SPHYNX_LOG_RING_SIZE - offset : 0;
+            uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            if (head + filler + length - tail > SPHYNX_LOG_RING_SIZE) {
+                __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+                return nullptr;
+            }
+            if (__atomic_compare_exchange_n(&ring->head, &head, head + filler + length, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+
+        if (filler) {
+            record_t* record = record_at(ring, head);
+            record->length = filler;
+            record->level = LEVEL_FILLER;
+            __atomic_store_n(&record->seq, head + 1, __ATOMIC_RELEASE);
+            head += filler;
+        }
+        *position = head;
+        return record_at(ring, head);
+    }
+
+    void write(int level, const char* name, const char* fmt, va_list args) {
+        char text[KLOG_LINE_MAX];
+        int textLength = npf_vsnprintf(text, sizeof(text), fmt, args);
+        if (textLength < 0) {
+            return;
+        }
+        textLength = MIN(textLength, KLOG_LINE_MAX - 1);
+        size_t nameLength = MIN(strlen(name), 255ul);
+        uint64_t timestamp = TSC::read();
+
+        ring_t* ring = __atomic_load_n(&ready, __ATOMIC_ACQUIRE) ? __atomic_load_n(&rings[PerCPU::id()], __ATOMIC_ACQUIRE) : nullptr;
+        if (!ring || __atomic_load_n(&panicking, __ATOMIC_RELAXED)) {
+            emit(level, name, nameLength, text, textLength, TSC::since_boot_ns(timestamp));
+            return;
+        }
+
+        uint32_t length = ALIGN_UP(sizeof(record_t) + nameLength + textLength, RECORD_ALIGN);
+        uint64_t position;
+        record_t* record = length <= SPHYNX_LOG_RING_SIZE / 2 ? reserve(ring, length, &position) : nullptr;
+        if (record) {
+            record->timestamp = timestamp;
+            record->length = length;
+            record->level = level;
+            record->nameLength = nameLength;
+            record->textLength = textLength;
+            memcpy(record->data, name, nameLength);
+            memcpy(record->data + nameLength, text, textLength);
+            __atomic_store_n(&record->seq, position + 1, __ATOMIC_RELEASE);
+            __atomic_fetch_add(&ring->records, 1, __ATOMIC_RELAXED);
+        }
+
+        // Interrupt handlers never pay for console output, everyone else helps out once a ring is half full
+        uint64_t used = __atomic_load_n(&ring->head, __ATOMIC_RELAXED) - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        if (!SPHYNX_LOG_DEFERRED || (!PerCPU::in_interrupt() && used >= SPHYNX_LOG_RING_SIZE / 2)) {
+            flush();
+        }
+    }
+
+    // Oldest complete record of a ring, skipping fillers, or nullptr when the next one is still being written
+    static record_t* peek(ring_t* ring) {
+        while (true) {
+            uint64_t tail = ring->tail;
+            if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+                return nullptr;
+            }
+            record_t* record = record_at(ring, tail);
+            if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+                return nullptr;
+            }
+            if (record->level != LEVEL_FILLER) {
+                return record;
+            }
+            __atomic_store_n(&ring->tail, tail + record->length, __ATOMIC_RELEASE);
+        }
+    }
+
+    static void drain() {
+        while (true) {
+            ring_t* oldest = nullptr;
+            record_t* record = nullptr;
+            for (uint32_t cpu = 0; cpu < SPHYNX_MAX_CPUS; cpu++) {
+                ring_t* ring = __atomic_load_n(&rings[cpu], __ATOMIC_ACQUIRE);
+                record_t* candidate = ring ? peek(ring) : nullptr;
+                if (candidate && (!record || candidate->timestamp < record->timestamp)) {
+                    oldest = ring;
+                    record = candidate;
+                }
+            }
+            if (!record) {
+                return;
+            }
+
+            emit(record->level, record->data, record->nameLength, record->data + record->nameLength, record->textLength,
+                TSC::since_boot_ns(record->timestamp));
+            __atomic_store_n(&oldest->tail, oldest->tail + record->length, __ATOMIC_RELEASE);
+        }
+    }
+
+    void flush() {
+        // Whoever is already draining picks up new records too, including an interrupted flush on this CPU
+        if (__atomic_exchange_n(&draining, true, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        __atomic_fetch_add(&flushes, 1, __ATOMIC_RELAXED);
+        drain();
+        __atomic_store_n(&draining, false, __ATOMIC_RELEASE);
+        Console::flush();
+    }
+
+    bool pending() {
+        for (uint32_t cpu = 0; cpu < SPHYNX_MAX_CPUS; cpu++) {
+            ring_t* ring = __atomic_load_n(&rings[cpu], __ATOMIC_ACQUIRE);
+            if (ring && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void panic_flush() {
+        __atomic_store_n(&panicking, true, __ATOMIC_RELEASE);
+        drain();
+        Console::flush();
+    }
+
+    stats_t get_stats() {
+        stats_t stats = {};
+        for (uint32_t cpu = 0; cpu < SPHYNX_MAX_CPUS; cpu++) {
+            ring_t* ring = __atomic_load_n(&rings[cpu], __ATOMIC_ACQUIRE);
+            if (ring) {
+                stats.records += __atomic_load_n(&ring->records, __ATOMIC_RELAXED);
+                stats.dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+            }
+        }
+        stats.flushes = __atomic_load_n(&flushes, __ATOMIC_RELAXED);
+        return stats;
+    }
+}
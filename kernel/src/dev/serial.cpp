@@ -29,9 +29,40 @@ Description: Sphynx serial I/O manager
 */
 
 #include <dev/serial.hpp>
+#include <core/idt.hpp>
+#include <core/pic.hpp>
+#include <sys/cpu.hpp>
+#include <math_utils.hpp>
 
 namespace Serial {
-	Stream::Stream(COM_PORTS port) : port(port) {
+	#define REG_IER 1
+	#define REG_IIR 2
+	#define REG_LSR 5
+	#define REG_MSR 6
+
+	#define IER_RX_DATA 0x01
+	#define IER_TX_EMPTY 0x02
+	#define IER_LINE_STATUS 0x04
+
+	#define IIR_NONE 0x01
+	#define IIR_MODEM_STATUS 0
+	#define IIR_TX_EMPTY 1
+	#define IIR_RX_DATA 2
+	#define IIR_LINE_STATUS 3
+	#define IIR_RX_TIMEOUT 6
+
+	#define LSR_DATA_READY 0x01
+	#define LSR_OVERRUN 0x02
+	#define LSR_TX_EMPTY 0x20
+
+	// Bytes the transmit FIFO takes once it reports empty
+	#define TX_FIFO_SIZE 16
+
+	static_assert((SERIAL_TX_RING & (SERIAL_TX_RING - 1)) == 0, "serial TX ring size must be a power of two");
+	static_assert((SERIAL_RX_RING & (SERIAL_RX_RING - 1)) == 0, "serial RX ring size must be a power of two");
+
+	Stream::Stream(COM_PORTS port) : port(port), irqMode(false), txReserve(0), txCommit(0), txTail(0), txBusy(false),
+		rxHead(0), rxTail(0), stats() {
 		outb(port + 1, 0x00);
 	    outb(port + 3, 0x80);
 	    outb(port + 0, 0x03);
@@ -52,7 +83,7 @@ namespace Serial {
 	}
 
 	bool Stream::is_transmit_empty() { 
-		return inb(port + 5) & 0x20;
+		return inb(port + REG_LSR) & LSR_TX_EMPTY;
 	}
 
 	bool Stream::serial_recived() {
@@ -69,6 +100,177 @@ namespace Serial {
 		outb(port, data);
 	}
 
+	bool Stream::enable_irq(uint8_t irq) {
+		if (is_error || !IDT::register_irq(irq, irq_handler, this)) {
+			return false;
+		}
+
+		// OUT2 in the modem control register, set by the constructor, gates the line to the PIC
+		outb(port + REG_IER, IER_RX_DATA | IER_TX_EMPTY | IER_LINE_STATUS);
+		__atomic_store_n(&irqMode, true, __ATOMIC_RELEASE);
+		PIC::unmask(irq);
+		pump_tx(false);
+		return true;
+	}
+
+	size_t Stream::write(const char* buffer, size_t length) {
+		// Without interrupts nothing would ever drain the ring, so send what is queued and then the buffer by polling.
+		// When the consumer side is held by a context we interrupted, a panic for instance, the queue has to wait
+		if (!__atomic_load_n(&irqMode, __ATOMIC_ACQUIRE) || !irq_enabled()) {
+			pump_tx(true);
+			for (size_t i = 0; i < length; i++) {
+				write(static_cast<uint8_t>(buffer[i]));
+			}
+			__atomic_fetch_add(&stats.txBytes, length, __ATOMIC_RELAXED);
+			return length;
+		}
+
+		// Nothing on this CPU can get between reserving and committing, so waiting for earlier writers is bounded
+		uint64_t flags = irq_save();
+		uint64_t start = __atomic_load_n(&txReserve, __ATOMIC_RELAXED);
+		uint64_t count;
+		do {
+			uint64_t used = start - __atomic_load_n(&txTail, __ATOMIC_ACQUIRE);
+			count = MIN(length, SERIAL_TX_RING - used);
+		} while (count != 0 && !__atomic_compare_exchange_n(&txReserve, &start, start + count, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+		if (count != 0) {
+			for (uint64_t i = 0; i < count; i++) {
+				txRing[(start + i) & (SERIAL_TX_RING - 1)] = buffer[i];
+			}
+			while (__atomic_load_n(&txCommit, __ATOMIC_ACQUIRE) != start) {
+				__asm__ volatile("pause");
+			}
+			__atomic_store_n(&txCommit, start + count, __ATOMIC_RELEASE);
+		}
+		irq_restore(flags);
+
+		if (count < length) {
+			__atomic_fetch_add(&stats.txDropped, length - count, __ATOMIC_RELAXED);
+		}
+		pump_tx(false);
+		return count;
+	}
+
+	// Moves committed bytes into the FIFO. Without poll it stops when the FIFO is busy and the TX empty interrupt
+	// resumes later. Returns false when another context is already consuming
+	bool Stream::pump_tx(bool poll) {
+		while (true) {
+			if (__atomic_exchange_n(&txBusy, true, __ATOMIC_ACQUIRE)) {
+				return false;
+			}
+
+			uint64_t tail = txTail;
+			while (true) {
+				uint64_t commit = __atomic_load_n(&txCommit, __ATOMIC_ACQUIRE);
+				if (tail == commit) {
+					break;
+				}
+				if (!is_transmit_empty()) {
+					if (!poll) {
+						break;
+					}
+					__asm__ volatile("pause");
+					continue;
+				}
+
+				uint64_t sent = 0;
+				while (sent < TX_FIFO_SIZE && tail != commit) {
+					outb(port, txRing[tail & (SERIAL_TX_RING - 1)]);
+					tail++;
+					sent++;
+				}
+				__atomic_store_n(&txTail, tail, __ATOMIC_RELEASE);
+				__atomic_fetch_add(&stats.txBytes, sent, __ATOMIC_RELAXED);
+			}
+			__atomic_store_n(&txBusy, false, __ATOMIC_RELEASE);
+
+			// A writer that committed while we held txBusy left its bytes to us. If the FIFO is empty no interrupt
+			// is coming for them, so go round again
+			if (__atomic_load_n(&txCommit, __ATOMIC_ACQUIRE) == tail || !is_transmit_empty()) {
+				return true;
+			}
+		}
+	}
+
+	void Stream::receive() {
+		uint8_t status;
+		while ((status = inb(port + REG_LSR)) & LSR_DATA_READY) {
+			if (status & LSR_OVERRUN) {
+				__atomic_fetch_add(&stats.overruns, 1, __ATOMIC_RELAXED);
+			}
+
+			char data = inb(port);
+			uint64_t head = rxHead;
+			if (head - __atomic_load_n(&rxTail, __ATOMIC_ACQUIRE) == SERIAL_RX_RING) {
+				__atomic_fetch_add(&stats.rxDropped, 1, __ATOMIC_RELAXED);
+				continue;
+			}
+			rxRing[head & (SERIAL_RX_RING - 1)] = data;
+			__atomic_store_n(&rxHead, head + 1, __ATOMIC_RELEASE);
+			__atomic_fetch_add(&stats.rxBytes, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	size_t Stream::read(char* buffer, size_t length) {
+		if (!__atomic_load_n(&irqMode, __ATOMIC_ACQUIRE)) {
+			receive();
+		}
+
+		uint64_t tail = rxTail;
+		uint64_t head = __atomic_load_n(&rxHead, __ATOMIC_ACQUIRE);
+		size_t count = MIN(length, head - tail);
+		for (size_t i = 0; i < count; i++) {
+			buffer[i] = rxRing[(tail + i) & (SERIAL_RX_RING - 1)];
+		}
+		__atomic_store_n(&rxTail, tail + count, __ATOMIC_RELEASE);
+		return count;
+	}
+
+	void Stream::irq_handler(uint8_t, void* ctx) {
+		Stream* stream = static_cast<Stream*>(ctx);
+		__atomic_fetch_add(&stream->stats.interrupts, 1, __ATOMIC_RELAXED);
+
+		// The UART queues its causes, keep going until it has none left. Bounded so a wedged port can't hang us
+		for (int i = 0; i < 16; i++) {
+			uint8_t iir = inb(stream->port + REG_IIR);
+			if (iir & IIR_NONE) {
+				break;
+			}
+
+			switch ((iir >> 1) & 0x07) {
+			case IIR_LINE_STATUS:
+				if (inb(stream->port + REG_LSR) & LSR_OVERRUN) {
+					__atomic_fetch_add(&stream->stats.overruns, 1, __ATOMIC_RELAXED);
+				}
+				break;
+			case IIR_RX_DATA:
+			case IIR_RX_TIMEOUT:
+				stream->receive();
+				break;
+			case IIR_TX_EMPTY:
+				stream->pump_tx(false);
+				break;
+			case IIR_MODEM_STATUS:
+				inb(stream->port + REG_MSR);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	stats_t Stream::get_stats() {
+		stats_t copy;
+		copy.txBytes = __atomic_load_n(&stats.txBytes, __ATOMIC_RELAXED);
+		copy.rxBytes = __atomic_load_n(&stats.rxBytes, __ATOMIC_RELAXED);
+		copy.txDropped = __atomic_load_n(&stats.txDropped, __ATOMIC_RELAXED);
+		copy.rxDropped = __atomic_load_n(&stats.rxDropped, __ATOMIC_RELAXED);
+		copy.overruns = __atomic_load_n(&stats.overruns, __ATOMIC_RELAXED);
+		copy.interrupts = __atomic_load_n(&stats.interrupts, __ATOMIC_RELAXED);
+		return copy;
+	}
+
 	bool Stream::has_error() {
 		return is_error;
 	}
@@ -44,65 +44,167 @@ typedef long ssize_t;
 #include <external/nanoprintf.h>
 
 #include <dev/serial.hpp>
+#include <core/mm/heap.hpp>
+#include <dev/fbcon.hpp>
+#include <sys/spinlock.hpp>
+#include <sys/trace.hpp>
+#include <string.hpp>
+
+namespace Console {
+    #define CHUNK_SIZE 256
+
+    typedef struct {
+        const char* name;
+        uint32_t kind;
+        sink_write_t write;
+        void* ctx;
+        int level;
+        sink_flush_t flush;
+    } sink_t;
+
+    typedef struct {
+        uint32_t kinds;
+        int level;
+        size_t used;
+        char buffer[CHUNK_SIZE];
+    } chunk_t;
+
+    static void fb_write(void*, const char* buffer, size_t length) {
+        if (ftCtx != nullptr) {
+            FBCon::write(ftCtx, buffer, length);
+        }
+    }
 
-void _putc(char ch) {
-    flanterm_write(ftCtx, &ch, sizeof(ch));
-}
+    static void fb_flush(void*) {
+        FBCon::flush();
+    }
 
-void _dputc(char ch) {
-    Serial::outb(0xE9, ch);
-}
+    static void e9_write(void*, const char* buffer, size_t length) {
+        __asm__ volatile("rep outsb" : "+S"(buffer), "+c"(length) : "d"(0xE9) : "memory");
+    }
 
-int kprintf(const char* fmt, ...) {
-    char buffer[1024];
-    va_list args;
+    static void uart_write(void* ctx, const char* buffer, size_t length) {
+        static_cast<Serial::Stream*>(ctx)->write(buffer, length);
+    }
 
-    va_start(args, fmt);
-    int length = npf_vsnprintf(buffer, sizeof(buffer), fmt, args);
-    va_end(args);
+    // Constant initialized so printing works before anything else has run
+    static sink_t sinks[CONSOLE_MAX_SINKS] = {
+        { "fb", SINK_SCREEN, fb_write, nullptr, 0, fb_flush },
+        { "e9", SINK_DEBUG, e9_write, nullptr, 0, nullptr },
+    };
+    static uint32_t sinkCount = 2;
+    static Spinlock sinkLock;
+
+    bool add_sink(const char* name, uint32_t kind, sink_write_t write, void* ctx, int level, sink_flush_t flush) {
+        sinkLock.lock();
+        if (sinkCount == CONSOLE_MAX_SINKS) {
+            sinkLock.unlock();
+            return false;
+        }
+        sinks[sinkCount] = { name, kind, write, ctx, level, flush };
+        // Writers read the count without the lock, publish it only once the entry is complete
+        __atomic_store_n(&sinkCount, sinkCount + 1, __ATOMIC_RELEASE);
+        sinkLock.unlock();
+        return true;
+    }
 
-    if (length < 0 || length >= (int)sizeof(buffer)) {
-        return -1;
+    bool set_level(const char* name, int level) {
+        uint32_t count = __atomic_load_n(&sinkCount, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < count; i++) {
+            if (strcmp(sinks[i].name, name) == 0) {
+                __atomic_store_n(&sinks[i].level, level, __ATOMIC_RELAXED);
+                return true;
+            }
+        }
+        return false;
     }
 
-    for (int i = 0; i < length; ++i) {
-        _putc(buffer[i]);
+    // There is no heap yet when the UART is added, and no global constructors
+    alignas(Serial::Stream) static uint8_t uartStorage[sizeof(Serial::Stream)];
+    static Serial::Stream* uart = nullptr;
+
+    bool add_uart(uint16_t port, int level) {
+        if (uart != nullptr) {
+            return false;
+        }
+        Serial::Stream* stream = new (uartStorage) Serial::Stream(static_cast<Serial::COM_PORTS>(port));
+        if (stream->has_error() || !add_sink("uart", SINK_DEBUG, uart_write, stream, level)) {
+            return false;
+        }
+        uart = stream;
+        return true;
     }
 
-    return length;
-}
+    Serial::Stream* get_uart() {
+        return uart;
+    }
 
-int kdprintf(const char* fmt, ...) {
-    char buffer[1024];
-    va_list args;
+    void write(uint32_t kinds, int level, const char* buffer, size_t length) {
+        if (length == 0) {
+            return;
+        }
+        TRACEPOINT(console_write, "console write %llu bytes kinds %x level %d", length, kinds, level);
+        uint32_t count = __atomic_load_n(&sinkCount, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < count; i++) {
+            if ((sinks[i].kind & kinds) && level >= __atomic_load_n(&sinks[i].level, __ATOMIC_RELAXED)) {
+                sinks[i].write(sinks[i].ctx, buffer, length);
+            }
+        }
+    }
 
-    va_start(args, fmt);
-    int length = npf_vsnprintf(buffer, sizeof(buffer), fmt, args);
-    va_end(args);
+    void flush() {
+        uint32_t count = __atomic_load_n(&sinkCount, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < count; i++) {
+            if (sinks[i].flush) {
+                sinks[i].flush(sinks[i].ctx);
+            }
+        }
+    }
 
-    if (length < 0 || length >= (int)sizeof(buffer)) {
-        return -1;
+    static void chunk_putc(int ch, void* ctx) {
+        chunk_t* chunk = static_cast<chunk_t*>(ctx);
+        chunk->buffer[chunk->used++] = static_cast<char>(ch);
+        if (chunk->used == CHUNK_SIZE) {
+            write(chunk->kinds, chunk->level, chunk->buffer, chunk->used);
+            chunk->used = 0;
+        }
     }
 
-    for (int i = 0; i < length; ++i) {
-        _dputc(buffer[i]);
+    int vprint(uint32_t kinds, int level, const char* fmt, va_list args) {
+        chunk_t chunk;
+        chunk.kinds = kinds;
+        chunk.level = level;
+        chunk.used = 0;
+        int length = npf_vpprintf(chunk_putc, &chunk, fmt, args);
+        write(kinds, level, chunk.buffer, chunk.used);
+        return length;
     }
+}
 
+int kprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int length = Console::vprint(Console::SINK_SCREEN, CONSOLE_LEVEL_RAW, fmt, args);
+    va_end(args);
     return length;
 }
 
-void vprintf(const char* fmt, va_list args) {
-    char buffer[1024];
-    int length = npf_vsnprintf(buffer, sizeof(buffer), fmt, args);
+int kdprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int length = Console::vprint(Console::SINK_DEBUG, CONSOLE_LEVEL_RAW, fmt, args);
+    va_end(args);
+    return length;
+}
 
-    if (length < 0 || length >= (int)sizeof(buffer)) {
-        return;
-    }
+int kmprintf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int length = Console::vprint(Console::SINK_ALL, CONSOLE_LEVEL_RAW, fmt, args);
+    va_end(args);
+    return length;
+}
 
-    for (int i = 0; i < length; ++i) {
-        #if SPHYNX_MIRROR_PRINTF
-        _dputc(buffer[i]);
-        #endif
-        _putc(buffer[i]);
-    }
+void vprintf(const char* fmt, va_list args) {
+    Console::vprint(Console::SINK_PRINTF, CONSOLE_LEVEL_RAW, fmt, args);
 }
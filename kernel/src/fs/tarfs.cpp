@@ -0,0 +1,349 @@
+/*
+Sphynx Operating System
+
+File: tarfs.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Read only file system over the ramfs tar
+*/
+
+#include <fs/tarfs.hpp>
+#include <data/tar.hpp>
+#include <data/lz4.hpp>
+#include <core/mm/pmm.hpp>
+#include <core/mm/vmm.hpp>
+#include <core/mm/heap.hpp>
+#include <sys/spinlock.hpp>
+#include <string.hpp>
+#include <math_utils.hpp>
+
+namespace Tarfs {
+    // Decompressed contents of one compressed entry, one page at a time so no file is too large for the PMM,
+    // linked into a global LRU while resident
+    typedef struct cache_entry {
+        uint8_t** pages;
+        uint64_t count;
+        struct cache_entry* prev;
+        struct cache_entry* next;
+    } cache_entry_t;
+
+    typedef struct {
+        TarIndex* index;
+        // Parallel to the index entries, only used for compressed ones
+        cache_entry_t* cache;
+    } fs_t;
+
+    typedef struct {
+        fs_t* fs;
+        const tar_entry_t* entry;
+    } node_t;
+
+    static Spinlock cacheLock;
+    static cache_entry_t* lruHead = nullptr;
+    static cache_entry_t* lruTail = nullptr;
+    static cache_stats_t stats;
+
+    static int lookup(VFS::vnode_t* dir, const char* name, size_t length, VFS::vnode_t** out);
+    static int64_t read(VFS::vnode_t* node, uint64_t offset, void* buffer, uint64_t length);
+    static int readdir(VFS::vnode_t* dir, uint64_t* cookie, VFS::dirent_t* out);
+    static void release(VFS::vnode_t* node);
+    static int map_page(VFS::vnode_t* node, uint64_t offset, uint64_t* phys);
+
+    static const VFS::vnode_ops_t ops = {
+        lookup,
+        read,
+        readdir,
+        release,
+        map_page,
+    };
+
+    static VFS::vnode_t* make_vnode(fs_t* fs, const tar_entry_t* entry) {
+        node_t* data = static_cast<node_t*>(kmalloc(sizeof(node_t)));
+        if (!data) {
+            return nullptr;
+        }
+        data->fs = fs;
+        data->entry = entry;
+
+        VFS::vnode_t* node = VFS::vnode_create(entry->file.is_directory ? VFS::VNODE_DIR : VFS::VNODE_FILE, entry->file.size, &ops, data);
+        if (!node) {
+            kfree(data);
+        }
+        return node;
+    }
+
+    static int lookup(VFS::vnode_t* dir, const char* name, size_t length, VFS::vnode_t** out) {
+        node_t* data = static_cast<node_t*>(dir->data);
+        const tar_entry_t* child = data->fs->index->lookup_child(data->entry, name, length);
+        if (!child) {
+            return -VFS_ENOENT;
+        }
+        *out = make_vnode(data->fs, child);
+        return *out ? 0 : -VFS_ENOMEM;
+    }
+
+    static void lru_unlink(cache_entry_t* cached) {
+        if (cached->prev) {
+            cached->prev->next = cached->next;
+        } else {
+            lruHead = cached->next;
+        }
+        if (cached->next) {
+            cached->next->prev = cached->prev;
+        } else {
+            lruTail = cached->prev;
+        }
+        cached->prev = cached->next = nullptr;
+    }
+
+    static void lru_push(cache_entry_t* cached) {
+        cached->prev = nullptr;
+        cached->next = lruHead;
+        if (lruHead) {
+            lruHead->prev = cached;
+        } else {
+            lruTail = cached;
+        }
+        lruHead = cached;
+    }
+
+    static uint64_t array_pages(uint64_t count) {
+        return DIV_ROUNDUP(count * sizeof(uint8_t*), PAGE_SIZE);
+    }
+
+    // Contents plus the pages array, what an entry really takes out of the PMM
+    static uint64_t cost(uint64_t count) {
+        return count + array_pages(count);
+    }
+
+    // Everything comes straight from the PMM, the shrinker frees it from inside failing allocations where a slab
+    // cache lock may be held
+    static void free_contents(uint8_t** pages, uint64_t count) {
+        for (uint64_t i = 0; i < count; i++) {
+            PMM::free_pages(reinterpret_cast<void*>(VMM::virt_to_phys(pages[i])));
+        }
+        PMM::free_pages(reinterpret_cast<void*>(VMM::virt_to_phys(pages)));
+    }
+
+    static uint8_t** alloc_contents(uint64_t count) {
+        void* array = PMM::request_pages(array_pages(count));
+        if (!array) {
+            return nullptr;
+        }
+        uint8_t** pages = static_cast<uint8_t**>(VMM::phys_to_virt(reinterpret_cast<uint64_t>(array)));
+        for (uint64_t i = 0; i < count; i++) {
+            void* page = PMM::request_pages(1);
+            if (!page) {
+                free_contents(pages, i);
+                return nullptr;
+            }
+            pages[i] = static_cast<uint8_t*>(VMM::phys_to_virt(reinterpret_cast<uint64_t>(page)));
+        }
+        return pages;
+    }
+
+    static void evict(cache_entry_t* cached) {
+        lru_unlink(cached);
+        free_contents(cached->pages, cached->count);
+        stats.cachedPages -= cost(cached->count);
+        stats.evictions++;
+        cached->pages = nullptr;
+        cached->count = 0;
+    }
+
+    // Evicts from the cold end until the cache holds at most limit pages, call with cacheLock held
+    static uint64_t shrink_locked(uint64_t limit) {
+        uint64_t freed = 0;
+        while (lruTail && stats.cachedPages > limit) {
+            freed += cost(lruTail->count);
+            evict(lruTail);
+        }
+        return freed;
+    }
+
+    // Finds the decompressed contents, decoding the frame on first use, call with cacheLock held
+    static int get_contents(fs_t* fs, const tar_entry_t* entry, cache_entry_t** out) {
+        cache_entry_t* cached = &fs->cache[entry - fs->index->root()];
+        if (cached->pages) {
+            stats.hits++;
+            if (cached != lruHead) {
+                lru_unlink(cached);
+                lru_push(cached);
+            }
+            *out = cached;
+            return 0;
+        }
+
+        uint64_t count = DIV_ROUNDUP(entry->file.size, PAGE_SIZE);
+        if (count == 0) {
+            count = 1;
+        }
+        // Make room first so the cache never grows past its budget, then retry once with everything evicted
+        shrink_locked(cost(count) >= SPHYNX_RAMFS_CACHE_PAGES ? 0 : SPHYNX_RAMFS_CACHE_PAGES - cost(count));
+        uint8_t** pages = alloc_contents(count);
+        if (!pages && lruTail) {
+            shrink_locked(0);
+            pages = alloc_contents(count);
+        }
+        if (!pages) {
+            return -VFS_ENOMEM;
+        }
+
+        if (lz4_frame_decode_pages(entry->file.data, entry->storedSize, pages, PAGE_SIZE, entry->file.size) != entry->file.size) {
+            free_contents(pages, count);
+            stats.corrupt++;
+            return -VFS_EIO;
+        }
+        stats.decompressions++;
+        stats.cachedPages += cost(count);
+        cached->pages = pages;
+        cached->count = count;
+        lru_push(cached);
+        *out = cached;
+        return 0;
+    }
+
+    static int64_t read(VFS::vnode_t* node, uint64_t offset, void* buffer, uint64_t length) {
+        node_t* data = static_cast<node_t*>(node->data);
+        const tar_entry_t* entry = data->entry;
+        const File* file = &entry->file;
+        if (offset >= file->size) {
+            return 0;
+        }
+        if (length > file->size - offset) {
+            length = file->size - offset;
+        }
+        if (!entry->compressed) {
+            memcpy(buffer, static_cast<const uint8_t*>(file->data) + offset, length);
+            return length;
+        }
+
+        // Copy out under the lock so a concurrent shrink can't free the contents mid read
+        cacheLock.lock();
+        cache_entry_t* cached;
+        int status = get_contents(data->fs, entry, &cached);
+        if (status != 0) {
+            cacheLock.unlock();
+            return status;
+        }
+        uint8_t* dst = static_cast<uint8_t*>(buffer);
+        for (uint64_t done = 0; done < length;) {
+            uint64_t chunk = MIN(length - done, PAGE_SIZE - ((offset + done) & (PAGE_SIZE - 1)));
+            memcpy(dst + done, cached->pages[(offset + done) / PAGE_SIZE] + ((offset + done) & (PAGE_SIZE - 1)), chunk);
+            done += chunk;
+        }
+        cacheLock.unlock();
+        return length;
+    }
+
+    // The cookie is the index of the next child plus one, so a directory can be listed without rescanning it
+    static int readdir(VFS::vnode_t* dir, uint64_t* cookie, VFS::dirent_t* out) {
+        node_t* data = static_cast<node_t*>(dir->data);
+        TarIndex* index = data->fs->index;
+        const tar_entry_t* base = index->root();
+        if (*cookie == ~0ull) {
+            return 0;
+        }
+        const tar_entry_t* child;
+        if (*cookie == 0) {
+            child = index->first_child(data->entry);
+        } else {
+            // The cookie comes back from the file offset, which VFS::seek lets callers set to anything
+            // The root is its own parent, so index 0 is never a valid child
+            if (*cookie - 1 == 0 || *cookie - 1 >= index->get_count() || base[*cookie - 1].parent != static_cast<uint32_t>(data->entry - base)) {
+                return -VFS_EINVAL;
+            }
+            child = &base[*cookie - 1];
+        }
+        if (!child) {
+            return 0;
+        }
+
+        size_t length = child->nameLength - child->baseOffset;
+        if (length > VFS_NAME_MAX) {
+            length = VFS_NAME_MAX;
+        }
+        memcpy(out->name, child->file.name + child->baseOffset, length);
+        out->name[length] = '\0';
+        out->type = child->file.is_directory ? VFS::VNODE_DIR : VFS::VNODE_FILE;
+        out->size = child->file.size;
+
+        const tar_entry_t* next = index->next_sibling(child);
+        *cookie = next ? static_cast<uint64_t>(next - base) + 1 : ~0ull;
+        return 1;
+    }
+
+    static void release(VFS::vnode_t* node) {
+        kfree(node->data);
+    }
+
+    // Stored file data is part of the boot image and never moves, so page aligned data can be mapped as is.
+    // Compressed entries only exist in the evictable cache and are always copied
+    static int map_page(VFS::vnode_t* node, uint64_t offset, uint64_t* phys) {
+        const tar_entry_t* entry = static_cast<node_t*>(node->data)->entry;
+        const uint8_t* data = static_cast<const uint8_t*>(entry->file.data) + offset;
+        if (entry->compressed || (reinterpret_cast<uint64_t>(data) & (PAGE_SIZE - 1)) || offset + PAGE_SIZE > entry->file.size) {
+            return -VFS_ENOTSUP;
+        }
+        *phys = VMM::translate(VMM::kernel_space(), reinterpret_cast<uint64_t>(data));
+        return *phys ? 0 : -VFS_ENOTSUP;
+    }
+
+    VFS::vnode_t* create(const void* buffer, size_t size) {
+        static bool shrinkerRegistered = false;
+        if (!__atomic_exchange_n(&shrinkerRegistered, true, __ATOMIC_ACQ_REL)) {
+            PMM::register_shrinker(shrink);
+        }
+
+        fs_t* fs = static_cast<fs_t*>(kmalloc(sizeof(fs_t)));
+        if (!fs) {
+            return nullptr;
+        }
+        fs->index = new TarIndex();
+        fs->cache = nullptr;
+        if (!fs->index->build(buffer, size) || !(fs->cache = static_cast<cache_entry_t*>(kcalloc(fs->index->get_count(), sizeof(cache_entry_t))))) {
+            delete fs->index;
+            kfree(fs);
+            return nullptr;
+        }
+        return make_vnode(fs, fs->index->root());
+    }
+
+    uint64_t shrink(uint64_t pages) {
+        if (!cacheLock.try_lock()) {
+            return 0;
+        }
+        uint64_t limit = stats.cachedPages > pages ? stats.cachedPages - pages : 0;
+        uint64_t freed = shrink_locked(limit);
+        cacheLock.unlock();
+        return freed;
+    }
+
+    cache_stats_t get_cache_stats() {
+        cacheLock.lock();
+        cache_stats_t copy = stats;
+        cacheLock.unlock();
+        return copy;
+    }
+}
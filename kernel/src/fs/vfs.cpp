@@ -0,0 +1,702 @@
+/*
+Sphynx Operating System
+
+File: vfs.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Sphynx virtual file system
+*/
+
+#include <fs/vfs.hpp>
+#include <core/mm/pmm.hpp>
+#include <core/mm/heap.hpp>
+#include <sys/spinlock.hpp>
+#include <sys/cpu.hpp>
+#include <dev/tty.hpp>
+#include <string.hpp>
+#include <math_utils.hpp>
+
+namespace VFS {
+    #define DCACHE_BUCKETS 1024
+    // Unused leaf entries beyond this are evicted least recently used first
+    #define DCACHE_MAX 4096
+    #define DNAME_INLINE 32
+
+    struct mount;
+
+    typedef struct dentry {
+        struct dentry* parent;
+        struct dentry* hashNext;
+        // Only entries without users or cached children sit on the LRU
+        struct dentry* lruPrev;
+        struct dentry* lruNext;
+        // nullptr marks a negative entry, a name known not to exist
+        vnode_t* node;
+        struct mount* mounted;
+        uint64_t hash;
+        uint32_t children;
+        uint32_t refs;
+        bool onLru;
+        uint16_t length;
+        char* name;
+        char inlineName[DNAME_INLINE];
+    } dentry_t;
+
+    typedef struct mount {
+        // Root of the mounted file system, its parent is the parent of the directory it covers
+        dentry_t* root;
+        dentry_t* covered;
+        struct mount* next;
+    } mount_t;
+
+    typedef struct {
+        dentry_t* dentry;
+        vnode_t* node;
+        uint64_t offset;
+        bool used;
+    } file_t;
+
+    static Spinlock lock;
+    static Heap::cache_t* dentryCache = nullptr;
+    static Heap::cache_t* vnodeCache = nullptr;
+    static dentry_t* buckets[DCACHE_BUCKETS];
+    static dentry_t* lruHead = nullptr;
+    static dentry_t* lruTail = nullptr;
+    static dentry_t* rootDentry = nullptr;
+    static mount_t* mounts = nullptr;
+    static file_t files[VFS_MAX_FILES];
+    static dcache_stats_t stats;
+    static map_stats_t mapStats;
+
+    static inline uint64_t name_hash(const dentry_t* parent, const char* name, size_t length) {
+        uint64_t hash = 0xCBF29CE484222325ull ^ (reinterpret_cast<uint64_t>(parent) * 0x9E3779B97F4A7C15ull);
+        for (size_t i = 0; i < length; i++) {
+            hash ^= static_cast<unsigned char>(name[i]);
+            hash *= 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    static void lru_remove(dentry_t* d) {
+        if (!d->onLru) {
+            return;
+        }
+        if (d->lruPrev) {
+            d->lruPrev->lruNext = d->lruNext;
+        } else {
+            lruHead = d->lruNext;
+        }
+        if (d->lruNext) {
+            d->lruNext->lruPrev = d->lruPrev;
+        } else {
+            lruTail = d->lruPrev;
+        }
+        d->onLru = false;
+    }
+
+    static void lru_push(dentry_t* d) {
+        d->lruPrev = nullptr;
+        d->lruNext = lruHead;
+        if (lruHead) {
+            lruHead->lruPrev = d;
+        } else {
+            lruTail = d;
+        }
+        lruHead = d;
+        d->onLru = true;
+    }
+
+    // Puts an entry on the LRU once nothing pins it
+    static void maybe_unpin(dentry_t* d) {
+        if (d != rootDentry && d->refs == 0 && d->children == 0 && !d->mounted && !d->onLru) {
+            lru_push(d);
+        }
+    }
+
+    static void evict(dentry_t* d) {
+        lru_remove(d);
+        dentry_t** link = &buckets[d->hash % DCACHE_BUCKETS];
+        while (*link != d) {
+            link = &(*link)->hashNext;
+        }
+        *link = d->hashNext;
+
+        if (d->node) {
+            vnode_put(d->node);
+        }
+        if (d->name != d->inlineName) {
+            kfree(d->name);
+        }
+        dentry_t* parent = d->parent;
+        Heap::cache_free(dentryCache, d);
+        stats.entries--;
+        stats.evictions++;
+
+        if (parent) {
+            parent->children--;
+            maybe_unpin(parent);
+        }
+    }
+
+    static dentry_t* dentry_alloc(dentry_t* parent, const char* name, size_t length, vnode_t* node) {
+        dentry_t* d = static_cast<dentry_t*>(Heap::cache_alloc(dentryCache));
+        if (!d) {
+            return nullptr;
+        }
+        memset(d, 0, sizeof(dentry_t));
+        d->name = d->inlineName;
+        if (length >= DNAME_INLINE) {
+            d->name = static_cast<char*>(kmalloc(length + 1));
+            if (!d->name) {
+                Heap::cache_free(dentryCache, d);
+                return nullptr;
+            }
+        }
+        memcpy(d->name, name, length);
+        d->name[length] = '\0';
+        d->length = length;
+        d->parent = parent;
+        d->node = node;
+        return d;
+    }
+
+    static dentry_t* dcache_find(dentry_t* parent, const char* name, size_t length, uint64_t hash) {
+        for (dentry_t* d = buckets[hash % DCACHE_BUCKETS]; d; d = d->hashNext) {
+            if (d->hash == hash && d->parent == parent && d->length == length && memcmp(d->name, name, length) == 0) {
+                return d;
+            }
+        }
+        return nullptr;
+    }
+
+    static dentry_t* dcache_insert(dentry_t* parent, const char* name, size_t length, uint64_t hash, vnode_t* node) {
+        // The parent may itself be an unused leaf, keep it off the LRU so making room can't evict it
+        lru_remove(parent);
+        while (stats.entries >= DCACHE_MAX && lruTail) {
+            evict(lruTail);
+        }
+
+        dentry_t* d = dentry_alloc(parent, name, length, node);
+        if (!d) {
+            maybe_unpin(parent);
+            return nullptr;
+        }
+        d->hash = hash;
+        d->hashNext = buckets[hash % DCACHE_BUCKETS];
+        buckets[hash % DCACHE_BUCKETS] = d;
+        stats.entries++;
+
+        parent->children++;
+        lru_push(d);
+        return d;
+    }
+
+    // Resolves path one component at a time, hitting the backend only for names the cache hasn't seen
+    static int walk(const char* path, dentry_t** out) {
+        if (!rootDentry || !rootDentry->node) {
+            return -VFS_ENOENT;
+        }
+
+        dentry_t* d = rootDentry;
+        const char* p = path;
+        while (true) {
+            while (*p == '/') {
+                ++p;
+            }
+            if (!*p) {
+                break;
+            }
+            const char* name = p;
+            while (*p && *p != '/') {
+                ++p;
+            }
+            size_t length = p - name;
+
+            if (length > VFS_NAME_MAX) {
+                return -VFS_EINVAL;
+            }
+            // Checked before "." and ".." too, "file/.." must not resolve to the file's directory
+            if (d->node->type != VNODE_DIR) {
+                return -VFS_ENOTDIR;
+            }
+            if (length == 1 && name[0] == '.') {
+                continue;
+            }
+            if (length == 2 && name[0] == '.' && name[1] == '.') {
+                if (d->parent) {
+                    d = d->parent;
+                }
+                continue;
+            }
+
+            uint64_t hash = name_hash(d, name, length);
+            dentry_t* child = dcache_find(d, name, length, hash);
+            if (child) {
+                if (child->node) {
+                    stats.hits++;
+                } else {
+                    stats.negativeHits++;
+                }
+                if (child->onLru) {
+                    lru_remove(child);
+                    lru_push(child);
+                }
+            } else {
+                stats.misses++;
+                if (!d->node->ops->lookup) {
+                    return -VFS_ENOENT;
+                }
+                stats.backendLookups++;
+                vnode_t* node = nullptr;
+                int status = d->node->ops->lookup(d->node, name, length, &node);
+                if (status != 0 && status != -VFS_ENOENT) {
+                    return status;
+                }
+                child = dcache_insert(d, name, length, hash, status == 0 ? node : nullptr);
+                if (!child) {
+                    if (node) {
+                        vnode_put(node);
+                    }
+                    return -VFS_ENOMEM;
+                }
+            }
+
+            if (!child->node) {
+                return -VFS_ENOENT;
+            }
+            d = child;
+            while (d->mounted) {
+                d = d->mounted->root;
+            }
+        }
+
+        *out = d;
+        return 0;
+    }
+
+    void init() {
+        dentryCache = Heap::cache_create("dentry", sizeof(dentry_t), alignof(dentry_t), nullptr);
+        vnodeCache = Heap::cache_create("vnode", sizeof(vnode_t), alignof(vnode_t), nullptr);
+        if (!dentryCache || !vnodeCache) {
+            kpanic(nullptr, "VFS: failed to create object caches");
+        }
+
+        rootDentry = dentry_alloc(nullptr, "", 0, nullptr);
+        if (!rootDentry) {
+            kpanic(nullptr, "VFS: failed to allocate the root dentry");
+        }
+        rootDentry->refs = 1;
+    }
+
+    vnode_t* vnode_create(VnodeType type, uint64_t size, const vnode_ops_t* ops, void* data) {
+        vnode_t* node = static_cast<vnode_t*>(Heap::cache_alloc(vnodeCache));
+        if (!node) {
+            return nullptr;
+        }
+        node->type = type;
+        node->size = size;
+        node->refs = 1;
+        node->ops = ops;
+        node->data = data;
+        return node;
+    }
+
+    void vnode_get(vnode_t* node) {
+        __atomic_fetch_add(&node->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    void vnode_put(vnode_t* node) {
+        if (__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+            return;
+        }
+        if (node->ops->release) {
+            node->ops->release(node);
+        }
+        Heap::cache_free(vnodeCache, node);
+    }
+
+    int mount(const char* path, vnode_t* root) {
+        if (!root || root->type != VNODE_DIR) {
+            return -VFS_ENOTDIR;
+        }
+
+        lock.lock();
+        if (!rootDentry->node) {
+            if (path[0] != '/' || path[1] != '\0') {
+                lock.unlock();
+                return -VFS_ENOENT;
+            }
+            rootDentry->node = root;
+            lock.unlock();
+            return 0;
+        }
+
+        dentry_t* covered;
+        int status = walk(path, &covered);
+        if (status == 0 && covered->node->type != VNODE_DIR) {
+            status = -VFS_ENOTDIR;
+        }
+        if (status == 0 && (covered == rootDentry || covered->mounted)) {
+            status = -VFS_EBUSY;
+        }
+        if (status != 0) {
+            lock.unlock();
+            return status;
+        }
+
+        mount_t* m = static_cast<mount_t*>(kmalloc(sizeof(mount_t)));
+        dentry_t* mountRoot = m ? dentry_alloc(covered->parent, covered->name, covered->length, root) : nullptr;
+        if (!mountRoot) {
+            kfree(m);
+            lock.unlock();
+            return -VFS_ENOMEM;
+        }
+        mountRoot->refs = 1;
+        m->root = mountRoot;
+        m->covered = covered;
+        m->next = mounts;
+        mounts = m;
+
+        lru_remove(covered);
+        covered->mounted = m;
+        lock.unlock();
+        return 0;
+    }
+
+    static file_t* get_file(int fd) {
+        if (fd < 0 || fd >= VFS_MAX_FILES || !files[fd].used) {
+            return nullptr;
+        }
+        return &files[fd];
+    }
+
+    int open(const char* path) {
+        lock.lock();
+        dentry_t* d;
+        int status = walk(path, &d);
+        if (status != 0) {
+            lock.unlock();
+            return status;
+        }
+
+        for (int fd = 0; fd < VFS_MAX_FILES; fd++) {
+            if (!files[fd].used) {
+                d->refs++;
+                lru_remove(d);
+                vnode_get(d->node);
+                files[fd] = { d, d->node, 0, true };
+                lock.unlock();
+                return fd;
+            }
+        }
+        lock.unlock();
+        return -VFS_EMFILE;
+    }
+
+    int close(int fd) {
+        lock.lock();
+        file_t* file = get_file(fd);
+        if (!file) {
+            lock.unlock();
+            return -VFS_EBADF;
+        }
+        file->dentry->refs--;
+        maybe_unpin(file->dentry);
+        vnode_t* node = file->node;
+        file->used = false;
+        lock.unlock();
+
+        vnode_put(node);
+        return 0;
+    }
+
+    int64_t read(int fd, void* buffer, uint64_t length) {
+        lock.lock();
+        file_t* file = get_file(fd);
+        if (!file) {
+            lock.unlock();
+            return -VFS_EBADF;
+        }
+        if (file->node->type == VNODE_DIR) {
+            lock.unlock();
+            return -VFS_EISDIR;
+        }
+        if (!file->node->ops->read) {
+            lock.unlock();
+            return -VFS_EINVAL;
+        }
+        vnode_t* node = file->node;
+        uint64_t offset = file->offset;
+        vnode_get(node);
+        lock.unlock();
+
+        // Backends may decompress or copy a lot, so they run without the VFS lock, the reference keeps
+        // the node alive if the descriptor is closed meanwhile
+        int64_t done = node->ops->read(node, offset, buffer, length);
+        if (done > 0) {
+            lock.lock();
+            if (get_file(fd) == file && file->node == node) {
+                file->offset = offset + done;
+            }
+            lock.unlock();
+        }
+        vnode_put(node);
+        return done;
+    }
+
+    int64_t seek(int fd, int64_t offset, int whence) {
+        lock.lock();
+        file_t* file = get_file(fd);
+        if (!file) {
+            lock.unlock();
+            return -VFS_EBADF;
+        }
+
+        int64_t base;
+        switch (whence) {
+            case VFS_SEEK_SET: base = 0; break;
+            case VFS_SEEK_CUR: base = file->offset; break;
+            case VFS_SEEK_END: base = file->node->size; break;
+            default:
+                lock.unlock();
+                return -VFS_EINVAL;
+        }
+        if (base + offset < 0) {
+            lock.unlock();
+            return -VFS_EINVAL;
+        }
+        file->offset = base + offset;
+        lock.unlock();
+        return base + offset;
+    }
+
+    int readdir(int fd, dirent_t* out) {
+        lock.lock();
+        file_t* file = get_file(fd);
+        if (!file) {
+            lock.unlock();
+            return -VFS_EBADF;
+        }
+        if (file->node->type != VNODE_DIR) {
+            lock.unlock();
+            return -VFS_ENOTDIR;
+        }
+        vnode_t* node = file->node;
+        if (!node->ops->readdir) {
+            lock.unlock();
+            return 0;
+        }
+        uint64_t cookie = file->offset;
+        vnode_get(node);
+        lock.unlock();
+
+        int status = node->ops->readdir(node, &cookie, out);
+        if (status > 0) {
+            lock.lock();
+            if (get_file(fd) == file && file->node == node) {
+                file->offset = cookie;
+            }
+            lock.unlock();
+        }
+        vnode_put(node);
+        return status;
+    }
+
+    int stat(const char* path, stat_t* out) {
+        lock.lock();
+        dentry_t* d;
+        int status = walk(path, &d);
+        if (status == 0) {
+            out->type = d->node->type;
+            out->size = d->node->size;
+        }
+        lock.unlock();
+        return status;
+    }
+
+    static void count_mapped(uint64_t* counter) {
+        lock.lock();
+        (*counter)++;
+        lock.unlock();
+    }
+
+    // Called without the lock, the backend may have to read or decompress the page
+    static bool map_file_page(vnode_t* node, VMM::address_space_t* space, uint64_t virt, uint64_t offset, uint64_t flags) {
+        uint64_t phys;
+        if (node->ops->map_page && offset + PAGE_SIZE <= node->size && node->ops->map_page(node, offset, &phys) == 0) {
+            if (!VMM::map(space, virt, phys, flags)) {
+                return false;
+            }
+            count_mapped(&mapStats.sharedPages);
+            return true;
+        }
+
+        // The tail past the end of the file has to read as zeroes, so the last partial page is always a copy
+        void* page = PMM::request_zeroed_pages(1);
+        if (!page) {
+            return false;
+        }
+        phys = reinterpret_cast<uint64_t>(page);
+        int64_t done = node->ops->read ? node->ops->read(node, offset, VMM::phys_to_virt(phys), PAGE_SIZE) : -VFS_EINVAL;
+        if (done < 0 || !VMM::map(space, virt, phys, flags | PTE_OWNED)) {
+            PMM::free_pages(page);
+            return false;
+        }
+        count_mapped(&mapStats.copiedPages);
+        return true;
+    }
+
+    int mmap(int fd, VMM::address_space_t* space, uint64_t virt, uint64_t length, uint64_t offset, uint64_t flags) {
+        if ((virt | offset) & (PAGE_SIZE - 1) || length == 0 || (flags & PTE_WRITABLE)) {
+            return -VFS_EINVAL;
+        }
+
+        lock.lock();
+        file_t* file = get_file(fd);
+        if (!file) {
+            lock.unlock();
+            return -VFS_EBADF;
+        }
+        vnode_t* node = file->node;
+        if (node->type == VNODE_DIR) {
+            lock.unlock();
+            return -VFS_EISDIR;
+        }
+        if (offset + length > ALIGN_UP(node->size, PAGE_SIZE)) {
+            lock.unlock();
+            return -VFS_EINVAL;
+        }
+        // VMM::map replaces whatever is there, an owned page mapped over would leak
+        for (uint64_t done = 0; done < length; done += PAGE_SIZE) {
+            int status = VMM::is_shared(space, virt + done) ? -VFS_EINVAL : VMM::translate(space, virt + done) ? -VFS_EEXIST : 0;
+            if (status != 0) {
+                lock.unlock();
+                return status;
+            }
+        }
+        vnode_get(node);
+        lock.unlock();
+
+        for (uint64_t done = 0; done < length; done += PAGE_SIZE) {
+            if (!map_file_page(node, space, virt + done, offset + done, flags)) {
+                vnode_put(node);
+                munmap(space, virt, done);
+                return -VFS_ENOMEM;
+            }
+        }
+        vnode_put(node);
+        return 0;
+    }
+
+    void munmap(VMM::address_space_t* space, uint64_t virt, uint64_t length) {
+        for (uint64_t done = 0; done < length; done += PAGE_SIZE) {
+            VMM::unmap(space, virt + done);
+        }
+    }
+
+    dcache_stats_t get_dcache_stats() {
+        lock.lock();
+        dcache_stats_t copy = stats;
+        lock.unlock();
+        return copy;
+    }
+
+    map_stats_t get_map_stats() {
+        lock.lock();
+        map_stats_t copy = mapStats;
+        lock.unlock();
+        return copy;
+    }
+
+    void self_test(const char* path) {
+        Logger logger("VFS");
+        // Top of the lower half, far above the identity map so its PML4 slot is private to a fresh space
+        const uint64_t base = 0x00007F8000000000ull;
+        stat_t st;
+        if (stat(path, &st) != 0) {
+            kpanic(nullptr, "VFS self test: file is missing");
+        }
+        uint64_t length = st.size ? ALIGN_UP(st.size, PAGE_SIZE) : PAGE_SIZE;
+        uint8_t* expected = static_cast<uint8_t*>(kmalloc(st.size + 1));
+        VMM::address_space_t* space = VMM::create_space();
+        int fd = open(path);
+        if (!expected || !space || fd < 0) {
+            kpanic(nullptr, "VFS self test: out of memory");
+        }
+        if (VMM::is_shared(space, base) || VMM::translate(space, base) != 0) {
+            kpanic(nullptr, "VFS self test: the test address is already in use");
+        }
+        if (read(fd, expected, st.size) != static_cast<int64_t>(st.size)) {
+            kpanic(nullptr, "VFS self test: short read");
+        }
+
+        if (mmap(fd, space, base, length, 0, PTE_WRITABLE) != -VFS_EINVAL || mmap(fd, space, base + 1, length, 0, 0) != -VFS_EINVAL ||
+            mmap(fd, space, base, length + PAGE_SIZE, 0, 0) != -VFS_EINVAL) {
+            kpanic(nullptr, "VFS self test: mmap accepted bad arguments");
+        }
+
+        map_stats_t before = get_map_stats();
+        if (st.size && mmap(fd, space, base, length, 0, 0) != 0) {
+            kpanic(nullptr, "VFS self test: mmap failed");
+        }
+        map_stats_t after = get_map_stats();
+        uint64_t shared = after.sharedPages - before.sharedPages;
+        uint64_t copied = after.copiedPages - before.copiedPages;
+        if (st.size && shared + copied != length / PAGE_SIZE) {
+            kpanic(nullptr, "VFS self test: map stats don't add up");
+        }
+        if (st.size && mmap(fd, space, base, PAGE_SIZE, 0, 0) != -VFS_EEXIST) {
+            kpanic(nullptr, "VFS self test: mmap replaced an existing mapping");
+        }
+
+        // Mapped bytes match read and a copied tail page is zero past the end of the file
+        for (uint64_t offset = 0; st.size && offset < length; offset += PAGE_SIZE) {
+            uint64_t phys = VMM::translate(space, base + offset);
+            if (!phys) {
+                kpanic(nullptr, "VFS self test: page is not mapped");
+            }
+            const uint8_t* page = static_cast<const uint8_t*>(VMM::phys_to_virt(phys));
+            uint64_t valid = MIN(PAGE_SIZE, st.size - offset);
+            if (memcmp(page, expected + offset, valid) != 0) {
+                kpanic(nullptr, "VFS self test: mapped contents differ from read");
+            }
+            for (uint64_t i = valid; i < PAGE_SIZE; i++) {
+                if (page[i] != 0) {
+                    kpanic(nullptr, "VFS self test: tail page isn't zeroed");
+                }
+            }
+        }
+
+        munmap(space, base, length);
+        for (uint64_t offset = 0; offset < length; offset += PAGE_SIZE) {
+            if (VMM::translate(space, base + offset) != 0) {
+                kpanic(nullptr, "VFS self test: munmap left a page mapped");
+            }
+        }
+        close(fd);
+        VMM::destroy_space(space);
+        kfree(expected);
+        logger.log(Logger::Level::INFO, "mmap of %s: %llu pages shared, %llu copied\n", path, shared, copied);
+    }
+}
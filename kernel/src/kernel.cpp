@@ -31,12 +31,25 @@ Description: Sphynx kernel entry
 #include <common.hpp>
 #include <stdint.h>
 #include <dev/tty.hpp>
+#include <dev/serial.hpp>
+#include <dev/fbcon.hpp>
 #include <sys/cpu.hpp>
+#include <sys/tsc.hpp>
+#include <sys/percpu.hpp>
+#include <sys/fpu.hpp>
+#include <sys/trace.hpp>
 #include <core/gdt.hpp>
 #include <core/idt.hpp>
+#include <core/mm/early.hpp>
 #include <core/mm/pmm.hpp>
+#include <core/mm/vmm.hpp>
+#include <core/mm/heap.hpp>
+#include <core/mm/profile.hpp>
 #include <external/seif.h>
-#include <data/tar.hpp>
+#include <fs/vfs.hpp>
+#include <fs/tarfs.hpp>
+#include <string.hpp>
+#include <simd.hpp>
 
 struct flanterm_context* ftCtx;
 struct boot *bootInfo;
@@ -44,6 +57,7 @@ struct file *ramfs;
 struct framebuffer *framebuffer;
 
 extern "C" void _start(boot_t* data) {
+    TSC::mark_boot();
     kdprintf("\033c");
     if (!data) {
         kdprintf(" - Error: Failed to get bootdata\n");
@@ -55,29 +69,30 @@ extern "C" void _start(boot_t* data) {
         hcf();
     }
 
+    if(data->memory_map == nullptr) {
+        kdprintf(" - Error: Failed to get memory map\n");
+        hcf();
+    }
+
     bootInfo = data;
     framebuffer = data->framebuffer;
 
+    // Boot time structures like the flanterm grid are sized from the screen, so they come from the early allocator
+    Early::init(data->memory_map);
+    string_init();
+
     uint32_t defaultBg = 0x2e3440;
     uint32_t defaultFg = 0xd8dee9;
 
-    ftCtx = flanterm_fb_init(
-        nullptr, nullptr, reinterpret_cast<uint32_t*>(framebuffer->address),
-        framebuffer->width, framebuffer->height,
-        framebuffer->pitch, framebuffer->red_mask_size,
-        framebuffer->red_mask_shift, framebuffer->green_mask_size,
-        framebuffer->green_mask_shift, framebuffer->blue_mask_size,
-        framebuffer->blue_mask_shift, nullptr, nullptr, nullptr, &defaultBg,
-        &defaultFg, nullptr, nullptr, nullptr, 0, 0, 1, 1, 1, 0
-    );
-
+    ftCtx = FBCon::init(framebuffer, defaultBg, defaultFg);
     if (!ftCtx) {
         kdprintf("- Error: Failed to initialize flanterm\n");
         hcf();
     }
 
-    ftCtx->cursor_enabled = false;
-    ftCtx->full_refresh(ftCtx);
+    // Rendering is the slowest sink, keep debug records on the debug port
+    Console::set_level("fb", Logger::Level::INFO);
+    Console::add_uart(Serial::COM1, Logger::Level::INFO);
     Logger logger("SphynxMain");
     #if SPHYNX_DEBUG
     logger.set_level(Logger::Level::DEBUG);
@@ -89,8 +104,23 @@ extern "C" void _start(boot_t* data) {
 
     GDT::init();
     logger.log(Logger::Level::OK, "GDT Initialized\n");
+    PerCPU::init_bsp();
+    KLog::init_cpu();
+    Trace::init_cpu();
     IDT::init();
     logger.log(Logger::Level::OK, "IDT Initialized\n");
+    // COM1 is wired to IRQ 4, from here on the UART drains its ring in the background
+    Serial::Stream* uart = Console::get_uart();
+    if (uart && !uart->enable_irq(4)) {
+        logger.log(Logger::Level::WARN, "Failed to hook up the COM1 interrupt, the UART stays polled\n");
+    }
+    irq_enable();
+    FPU::init();
+    FPU::self_test();
+    logger.log(Logger::Level::OK, "FPU Initialized, %u byte state, AVX %s, AVX2 %s\n", FPU::get_state_size(),
+        FPU::has_avx() ? "yes" : "no", FPU::has_avx2() ? "yes" : "no");
+    TSC::init();
+    logger.log(Logger::Level::OK, "TSC calibrated at %llu MHz\n", TSC::get_frequency() / 1000000);
 
 
     if(data->ramfs == nullptr) {
@@ -100,15 +130,111 @@ extern "C" void _start(boot_t* data) {
     ramfs = data->ramfs;
     logger.log(Logger::Level::INFO, "ramfs loaded\n");
 
-    if(data->memory_map == nullptr) {
-        kpanic(nullptr, "Failed to get memory map");
-    }
-    logger.log(Logger::Level::INFO, "Memory map loaded\n");
+    logger.log(Logger::Level::INFO, "Memory map loaded, %llu ranges after sanitizing\n", Early::get_range_count());
+    PMM::init();
+    logger.log(Logger::Level::OK, "PMM Initialized, %llu MiB free\n", PMM::get_free() / 1024 / 1024);
+    PMM::dump_zones();
+    #if SPHYNX_PMM_SELF_TEST
+    PMM::self_test();
+    #endif
+    #if SPHYNX_FB_FILL_TEST
+    uint64_t fillBefore = FBCon::measure_fill_rate();
+    #endif
+    VMM::init();
+    logger.log(Logger::Level::OK, "VMM Initialized\n");
+    #if SPHYNX_FB_FILL_TEST
+    logger.log(Logger::Level::INFO, "Framebuffer fill rate: %llu MiB/s with the firmware mapping, %llu MiB/s write-combining\n",
+        fillBefore, FBCon::measure_fill_rate());
+    #endif
+    Heap::init();
+    logger.log(Logger::Level::OK, "Heap Initialized\n");
+    Heap::dump_stats();
+    simd_self_test();
+    #if SPHYNX_STRING_SELF_TEST
+    string_self_test();
+    #endif
     logger.log(Logger::Level::DEBUG, "Screen Size: %dx%d\n", framebuffer->width, framebuffer->height);
     logger.log(Logger::Level::DEBUG, "Bootloader: %s\n", bootInfo->info->name);
 
-    File msg = get_file_tar(static_cast<char*>(ramfs->address), ramfs->size, "sys/welcome.txt");
+    VFS::init();
+    uint64_t mountStart = TSC::read();
+    VFS::vnode_t* ramfsRoot = Tarfs::create(static_cast<char*>(ramfs->address), ramfs->size);
+    if (!ramfsRoot || VFS::mount("/", ramfsRoot) != 0) {
+        kpanic(nullptr, "Failed to mount the ramfs");
+    }
+    logger.log(Logger::Level::OK, "ramfs mounted at / in %llu us\n", TSC::ticks_to_ns(TSC::read() - mountStart) / 1000);
+
+    // Tracepoints to turn on for this boot, the ramfs stands in for a kernel command line
+    VFS::stat_t traceStat;
+    if (VFS::stat("/sys/trace.conf", &traceStat) == 0) {
+        char* traceConf = static_cast<char*>(kmalloc(traceStat.size + 1));
+        int traceFd = VFS::open("/sys/trace.conf");
+        int64_t traceLength = traceConf && traceFd >= 0 ? VFS::read(traceFd, traceConf, traceStat.size) : -1;
+        VFS::close(traceFd);
+        if (traceLength >= 0) {
+            Trace::load_config(traceConf, traceLength);
+        } else {
+            logger.log(Logger::Level::WARN, "Failed to read sys/trace.conf\n");
+        }
+        kfree(traceConf);
+    }
+
+    VFS::stat_t welcomeStat;
+    if (VFS::stat("/sys/welcome.txt", &welcomeStat) != 0) {
+        kpanic(nullptr, "ramfs has no sys/welcome.txt");
+    }
+    char* welcome = static_cast<char*>(kmalloc(welcomeStat.size + 1));
+    if (!welcome) {
+        kpanic(nullptr, "Out of memory reading sys/welcome.txt");
+    }
+    int fd = VFS::open("/sys/welcome.txt");
+    int64_t welcomeLength = fd >= 0 ? VFS::read(fd, welcome, welcomeStat.size) : fd;
+    VFS::close(fd);
+    if (welcomeLength < 0) {
+        kpanic(nullptr, "Failed to read sys/welcome.txt");
+    }
+    welcome[welcomeLength] = '\0';
+
+    #if SPHYNX_VFS_SELF_TEST
+    VFS::self_test("/sys/welcome.txt");
+    #endif
+
+    VFS::dcache_stats_t dcache = VFS::get_dcache_stats();
+    logger.log(Logger::Level::DEBUG, "dcache: %llu hits, %llu misses, %llu backend lookups\n", dcache.hits, dcache.misses, dcache.backendLookups);
+    if (uart) {
+        Serial::stats_t serial = uart->get_stats();
+        logger.log(Logger::Level::DEBUG, "uart: %llu bytes sent, %llu dropped, %llu received, %llu overruns, %llu interrupts\n",
+            serial.txBytes, serial.txDropped, serial.rxBytes, serial.overruns, serial.interrupts);
+    }
+    FBCon::stats_t console = FBCon::get_stats();
+    logger.log(Logger::Level::DEBUG, "console: %llu us rendering, %llu us flushing %llu KiB in %llu flushes%s\n",
+        console.renderNs / 1000, console.flushNs / 1000, console.bytesFlushed / 1024, console.flushes,
+        FBCon::is_buffered() ? "" : " (unbuffered)");
     logger.log(Logger::Level::OK, "Kernel setup successfully.\n");
-    printf("%s\n", msg.data);
-    halt();
+    KLog::flush();
+    printf("%s\n", welcome);
+    kfree(welcome);
+    #if SPHYNX_ALLOC_PROFILE
+    AllocProfile::report(16);
+    #endif
+    #if SPHYNX_TRACE
+    Trace::dump();
+    #endif
+
+    KLog::flush();
+
+    // Idle loop, interrupts like the UART's still have to be served. Records they log are printed here and the
+    // zero page pool is topped up in small batches, the CPU only halts once neither has work left
+    for (;;) {
+        KLog::flush();
+        if (PMM::zero_idle(64) != 0) {
+            continue;
+        }
+        __asm__ volatile("cli");
+        if (KLog::pending()) {
+            irq_enable();
+            continue;
+        }
+        wait_for_interrupt();
+    }
 }
@@ -0,0 +1,177 @@
+/*
+Sphynx Operating System
+
+File: arena.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Chunked arena allocator
+*/
+
+#include <arena.hpp>
+#include <core/mm/pmm.hpp>
+#include <core/mm/vmm.hpp>
+#include <math_utils.hpp>
+
+struct Arena::chunk_t {
+    chunk_t* prev;
+    size_t size;
+    size_t used;
+    // Unique per activation, zero while the chunk sits on the spare list after a rewind
+    uint64_t serial;
+};
+
+Arena::Arena(size_t chunkSize) : current(nullptr), first(nullptr), spare(nullptr), reserved(0), nextSerial(1), generation(0) {
+    this->chunkSize = ALIGN_UP(MAX(chunkSize, static_cast<size_t>(PAGE_SIZE)), PAGE_SIZE);
+}
+
+Arena::~Arena() {
+    release();
+}
+
+static inline uint8_t* chunk_data(Arena::chunk_t* chunk) {
+    return reinterpret_cast<uint8_t*>(chunk);
+}
+
+bool Arena::grow(size_t size, size_t alignment) {
+    size_t needed = ALIGN_UP(sizeof(chunk_t), alignment) + size;
+
+    // Chunks dropped by a rewind are reused before asking the PMM
+    if (spare && spare->size >= needed) {
+        chunk_t* chunk = spare;
+        spare = chunk->prev;
+        chunk->prev = current;
+        chunk->used = sizeof(chunk_t);
+        chunk->serial = nextSerial++;
+        if (!current) {
+            first = chunk;
+        }
+        current = chunk;
+        return true;
+    }
+
+    size_t bytes = MAX(chunkSize, ALIGN_UP(needed, PAGE_SIZE));
+    void* phys = PMM::request_pages(bytes / PAGE_SIZE);
+    if (!phys) {
+        return false;
+    }
+
+    chunk_t* chunk = static_cast<chunk_t*>(VMM::phys_to_virt(reinterpret_cast<uint64_t>(phys)));
+    chunk->prev = current;
+    chunk->size = bytes;
+    chunk->used = sizeof(chunk_t);
+    chunk->serial = nextSerial++;
+    if (!current) {
+        first = chunk;
+    }
+    current = chunk;
+    reserved += bytes;
+    return true;
+}
+
+void* Arena::alloc(size_t size, size_t alignment) {
+    // Offsets are aligned within a chunk and chunks are only page aligned
+    if (alignment > PAGE_SIZE) {
+        return nullptr;
+    }
+    if (current) {
+        size_t offset = ALIGN_UP(current->used, alignment);
+        if (offset + size <= current->size) {
+            current->used = offset + size;
+            return chunk_data(current) + offset;
+        }
+    }
+
+    if (!grow(size, alignment)) {
+        return nullptr;
+    }
+    size_t offset = ALIGN_UP(current->used, alignment);
+    current->used = offset + size;
+    return chunk_data(current) + offset;
+}
+
+bool Arena::shrink_last(void* ptr, size_t size) {
+    if (!current || static_cast<uint8_t*>(ptr) + size != chunk_data(current) + current->used) {
+        return false;
+    }
+    current->used -= size;
+    return true;
+}
+
+Arena::savepoint_t Arena::save() const {
+    return { current, current ? current->used : 0, current ? current->serial : 0, generation };
+}
+
+void Arena::rewind(savepoint_t savepoint) {
+    // A spare or freed chunk never matches, its allocations are already gone. The serial is only read while the
+    // generation says the chunk is still owned by this arena
+    if (savepoint.generation != generation || (savepoint.chunk && savepoint.chunk->serial != savepoint.serial)) {
+        return;
+    }
+
+    while (current != savepoint.chunk) {
+        chunk_t* chunk = current;
+        current = chunk->prev;
+        chunk->prev = spare;
+        chunk->serial = 0;
+        spare = chunk;
+    }
+    if (current) {
+        current->used = savepoint.used;
+    } else {
+        first = nullptr;
+    }
+}
+
+void Arena::reset() {
+    // Spare chunks keep stale serials, the generation bump is what invalidates every outstanding savepoint
+    if (current) {
+        first->prev = spare;
+        spare = current;
+        current = nullptr;
+        first = nullptr;
+    }
+    generation++;
+}
+
+void Arena::release() {
+    reset();
+    while (spare) {
+        chunk_t* chunk = spare;
+        spare = chunk->prev;
+        PMM::free_pages(reinterpret_cast<void*>(VMM::virt_to_phys(chunk)));
+    }
+    reserved = 0;
+}
+
+size_t Arena::get_used() const {
+    size_t used = 0;
+    for (chunk_t* chunk = current; chunk; chunk = chunk->prev) {
+        used += chunk->used - sizeof(chunk_t);
+    }
+    return used;
+}
+
+size_t Arena::get_reserved() const {
+    return reserved;
+}
@@ -0,0 +1,297 @@
+/*
+Sphynx Operating System
+
+File: lz4.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: LZ4 frame decoder
+*/
+
+#include <data/lz4.hpp>
+#include <string.hpp>
+#include <math_utils.hpp>
+
+#define LZ4_FLG_DICT_ID (1 << 0)
+#define LZ4_FLG_CONTENT_CHECKSUM (1 << 2)
+#define LZ4_FLG_CONTENT_SIZE (1 << 3)
+#define LZ4_FLG_BLOCK_CHECKSUM (1 << 4)
+#define LZ4_FLG_VERSION_MASK 0xC0
+#define LZ4_FLG_VERSION 0x40
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000u
+#define LZ4_MIN_MATCH 4
+
+static inline uint32_t read_le32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static inline uint64_t read_le64(const uint8_t* p) {
+    return read_le32(p) | (static_cast<uint64_t>(read_le32(p + 4)) << 32);
+}
+
+// Parses the frame descriptor, returns its length or 0 when the header is unusable
+static size_t parse_header(const uint8_t* src, size_t srcSize, uint8_t* flags, uint64_t* contentSize) {
+    if (srcSize < 7 || read_le32(src) != LZ4_FRAME_MAGIC) {
+        return 0;
+    }
+    uint8_t flg = src[4];
+    if ((flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION) {
+        return 0;
+    }
+
+    size_t length = 6;
+    *contentSize = 0;
+    if (flg & LZ4_FLG_CONTENT_SIZE) {
+        if (srcSize < length + 8) {
+            return 0;
+        }
+        *contentSize = read_le64(src + length);
+        length += 8;
+    }
+    if (flg & LZ4_FLG_DICT_ID) {
+        // Frames that need an external dictionary can't be decoded on their own
+        return 0;
+    }
+    // Header checksum byte
+    length += 1;
+    if (srcSize < length) {
+        return 0;
+    }
+    *flags = flg;
+    return length;
+}
+
+bool lz4_frame_content_size(const void* src, size_t srcSize, uint64_t* out) {
+    const uint8_t* ip = static_cast<const uint8_t*>(src);
+    uint8_t flags;
+    uint64_t contentSize;
+    size_t header = parse_header(ip, srcSize, &flags, &contentSize);
+    if (!header) {
+        return false;
+    }
+    if (flags & LZ4_FLG_CONTENT_SIZE) {
+        *out = contentSize;
+        return true;
+    }
+    // The reference encoder leaves the size out of empty frames, those end with the EndMark right away
+    if (srcSize - header >= 4 && read_le32(ip + header) == 0) {
+        *out = 0;
+        return true;
+    }
+    return false;
+}
+
+// Output into one contiguous buffer
+class FlatOutput {
+public:
+    FlatOutput(void* dst, size_t capacity) : dst(static_cast<uint8_t*>(dst)), capacity(capacity) {}
+
+    bool literals(const uint8_t* src, size_t length) {
+        if (length > capacity - pos) {
+            return false;
+        }
+        memcpy(dst + pos, src, length);
+        pos += length;
+        return true;
+    }
+
+    bool match(size_t offset, size_t length) {
+        if (offset == 0 || offset > pos || length > capacity - pos) {
+            return false;
+        }
+        // Any multiple of offset reaching back no further than offset before the match start reads the same
+        // bytes, so an overlapping match copies in chunks that double instead of one period at a time
+        size_t start = pos;
+        while (length) {
+            size_t distance = offset * ((pos - start) / offset + 1);
+            size_t chunk = MIN(length, distance);
+            memcpy(dst + pos, dst + pos - distance, chunk);
+            pos += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    size_t pos = 0;
+
+private:
+    uint8_t* dst;
+    size_t capacity;
+};
+
+// Output scattered over equally sized pages, pageSize is a power of two
+class PagedOutput {
+public:
+    PagedOutput(uint8_t* const* pages, size_t pageSize, size_t capacity) : pages(pages), pageSize(pageSize), capacity(capacity) {}
+
+    bool literals(const uint8_t* src, size_t length) {
+        if (length > capacity - pos) {
+            return false;
+        }
+        while (length) {
+            size_t chunk = MIN(length, pageSize - (pos & (pageSize - 1)));
+            memcpy(at(pos), src, chunk);
+            src += chunk;
+            pos += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    bool match(size_t offset, size_t length) {
+        if (offset == 0 || offset > pos || length > capacity - pos) {
+            return false;
+        }
+        // Chunks double like in FlatOutput and also stop at page boundaries
+        size_t start = pos;
+        while (length) {
+            size_t distance = offset * ((pos - start) / offset + 1);
+            size_t from = pos - distance;
+            size_t chunk = MIN(MIN(length, distance), pageSize - (pos & (pageSize - 1)));
+            chunk = MIN(chunk, pageSize - (from & (pageSize - 1)));
+            memcpy(at(pos), at(from), chunk);
+            pos += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    size_t pos = 0;
+
+private:
+    uint8_t* at(size_t position) {
+        return pages[position / pageSize] + (position & (pageSize - 1));
+    }
+
+    uint8_t* const* pages;
+    size_t pageSize;
+    size_t capacity;
+};
+
+// Decodes one block at the current output position, earlier output stays addressable so linked blocks just work
+template <typename Output>
+static bool decode_block(const uint8_t* ip, const uint8_t* iend, Output* out) {
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > static_cast<size_t>(iend - ip) || !out->literals(ip, literals)) {
+            return false;
+        }
+        ip += literals;
+
+        // The last sequence of a block is literals only
+        if (ip == iend) {
+            break;
+        }
+        if (iend - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t match = token & 15;
+        if (match == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                b = *ip++;
+                match += b;
+            } while (b == 255);
+        }
+        if (!out->match(offset, match + LZ4_MIN_MATCH)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Output>
+static int64_t decode_frame(const void* src, size_t srcSize, Output* out) {
+    const uint8_t* ip = static_cast<const uint8_t*>(src);
+    const uint8_t* iend = ip + srcSize;
+    uint8_t flags;
+    uint64_t contentSize;
+    size_t header = parse_header(ip, srcSize, &flags, &contentSize);
+    if (!header) {
+        return -1;
+    }
+    ip += header;
+
+    while (true) {
+        if (iend - ip < 4) {
+            return -1;
+        }
+        uint32_t blockSize = read_le32(ip);
+        ip += 4;
+        if (blockSize == 0) {
+            break;
+        }
+
+        bool uncompressed = blockSize & LZ4_BLOCK_UNCOMPRESSED;
+        blockSize &= ~LZ4_BLOCK_UNCOMPRESSED;
+        if (blockSize > static_cast<size_t>(iend - ip)) {
+            return -1;
+        }
+
+        if (uncompressed ? !out->literals(ip, blockSize) : !decode_block(ip, ip + blockSize, out)) {
+            return -1;
+        }
+        ip += blockSize;
+
+        if (flags & LZ4_FLG_BLOCK_CHECKSUM) {
+            ip += 4;
+        }
+    }
+
+    // The checksum itself isn't verified but a frame missing it was cut short
+    if ((flags & LZ4_FLG_CONTENT_CHECKSUM) && iend - ip < 4) {
+        return -1;
+    }
+    if ((flags & LZ4_FLG_CONTENT_SIZE) && out->pos != contentSize) {
+        return -1;
+    }
+    return out->pos;
+}
+
+int64_t lz4_frame_decode(const void* src, size_t srcSize, void* dst, size_t dstCapacity) {
+    FlatOutput out(dst, dstCapacity);
+    return decode_frame(src, srcSize, &out);
+}
+
+int64_t lz4_frame_decode_pages(const void* src, size_t srcSize, uint8_t* const* pages, size_t pageSize, size_t dstCapacity) {
+    PagedOutput out(pages, pageSize, dstCapacity);
+    return decode_frame(src, srcSize, &out);
+}
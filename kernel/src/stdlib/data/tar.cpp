@@ -29,12 +29,21 @@ Description: TAR Parsing library
 */
 
 #include <data/tar.hpp>
+#include <data/lz4.hpp>
 #include <dev/tty.hpp>
 #include <string.hpp>
+#include <math_utils.hpp>
 
-static inline uint32_t octal_to_decimal(const char* octal_str) {
+#include <core/mm/heap.hpp>
+
+// Fields may be padded with spaces or fill their whole width without a terminator
+static inline uint32_t octal_to_decimal(const char* octal_str, size_t width = 12) {
     uint32_t result = 0;
-    while (*octal_str) {
+    while (width && *octal_str == ' ') {
+        ++octal_str;
+        --width;
+    }
+    while (width-- && *octal_str >= '0' && *octal_str <= '7') {
         result = (result << 3) + (*octal_str++ - '0');
     }
     return result;
@@ -100,3 +109,361 @@ File get_file_tar(const void* buffer, size_t size, const char* path) {
 
     return {};
 }
+
+// FNV-1a, cheap and spreads short path strings well enough for linear probing
+static inline uint64_t path_hash(const char* path, size_t length) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(path[i]);
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static inline size_t bounded_length(const char* field, size_t width) {
+    size_t length = 0;
+    while (length < width && field[length]) {
+        ++length;
+    }
+    return length;
+}
+
+// Looks for a "key=value" record in pax extended header data, records are "<length> <key>=<value>\n"
+static bool pax_has_record(const char* data, size_t size, const char* key, const char* value) {
+    size_t keyLength = strlen(key);
+    size_t valueLength = strlen(value);
+    size_t pos = 0;
+    while (pos < size) {
+        size_t length = 0;
+        size_t i = pos;
+        while (i < size && data[i] >= '0' && data[i] <= '9') {
+            length = length * 10 + (data[i++] - '0');
+        }
+        if (i >= size || data[i] != ' ' || length <= i + 1 - pos || length > size - pos) {
+            return false;
+        }
+        const char* record = data + i + 1;
+        size_t recordLength = pos + length - (i + 1);
+        if (recordLength == keyLength + valueLength + 2 && memcmp(record, key, keyLength) == 0 && record[keyLength] == '=' &&
+            memcmp(record + keyLength + 1, value, valueLength) == 0) {
+            return true;
+        }
+        pos += length;
+    }
+    return false;
+}
+
+static void normalize(const char** path, size_t* length) {
+    while (*length && (**path == '/' || (**path == '.' && (*length == 1 || (*path)[1] == '/')))) {
+        ++*path;
+        --*length;
+    }
+    while (*length && (*path)[*length - 1] == '/') {
+        --*length;
+    }
+}
+
+// Grows a kmalloc'd array to hold at least needed elements, doubling to keep the build linear
+static bool reserve_array(void** array, size_t* capacity, size_t element, size_t needed) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    size_t grown = *capacity ? *capacity : 64;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    void* fresh = kmalloc(grown * element);
+    if (!fresh) {
+        return false;
+    }
+    if (*array) {
+        memcpy(fresh, *array, *capacity * element);
+        kfree(*array);
+    }
+    *array = fresh;
+    *capacity = grown;
+    return true;
+}
+
+TarIndex::~TarIndex() {
+    release();
+}
+
+void TarIndex::release() {
+    kfree(entries);
+    kfree(slots);
+    names.release();
+    entries = nullptr;
+    slots = nullptr;
+    count = capacity = slotCount = 0;
+}
+
+uint32_t TarIndex::find(const char* path, size_t length, uint64_t hash) const {
+    if (slotCount == 0) {
+        return TAR_NO_ENTRY;
+    }
+    size_t i = hash & (slotCount - 1);
+    while (slots[i] != 0) {
+        const tar_entry_t* entry = &entries[slots[i] - 1];
+        if (entry->hash == hash && entry->nameLength == length && memcmp(entry->file.name, path, length) == 0) {
+            return slots[i] - 1;
+        }
+        i = (i + 1) & (slotCount - 1);
+    }
+    return TAR_NO_ENTRY;
+}
+
+bool TarIndex::grow_slots() {
+    size_t grown = slotCount ? slotCount * 2 : 256;
+    uint32_t* fresh = static_cast<uint32_t*>(kcalloc(grown, sizeof(uint32_t)));
+    if (!fresh) {
+        return false;
+    }
+    for (size_t e = 0; e < count; e++) {
+        size_t i = entries[e].hash & (grown - 1);
+        while (fresh[i] != 0) {
+            i = (i + 1) & (grown - 1);
+        }
+        fresh[i] = e + 1;
+    }
+    kfree(slots);
+    slots = fresh;
+    slotCount = grown;
+    return true;
+}
+
+uint32_t TarIndex::insert(const char* path, size_t length, bool directory) {
+    uint64_t hash = path_hash(path, length);
+    uint32_t existing = find(path, length, hash);
+    if (existing != TAR_NO_ENTRY) {
+        return existing;
+    }
+
+    char* name = static_cast<char*>(names.alloc(length + 1, 1));
+    if (!name) {
+        return TAR_NO_ENTRY;
+    }
+    if (!reserve_array(reinterpret_cast<void**>(&entries), &capacity, sizeof(tar_entry_t), count + 1)) {
+        return TAR_NO_ENTRY;
+    }
+    // Keep the table at most half full
+    if ((count + 1) * 2 > slotCount && !grow_slots()) {
+        return TAR_NO_ENTRY;
+    }
+
+    memcpy(name, path, length);
+    name[length] = '\0';
+
+    uint32_t index = count++;
+    tar_entry_t* entry = &entries[index];
+    entry->file = { name, 0, nullptr, directory };
+    entry->hash = hash;
+    entry->nameLength = length;
+    entry->baseOffset = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (path[i] == '/') {
+            entry->baseOffset = i + 1;
+        }
+    }
+    entry->firstChild = TAR_NO_ENTRY;
+    entry->nextSibling = TAR_NO_ENTRY;
+    entry->parent = TAR_NO_ENTRY;
+    entry->storedSize = 0;
+    entry->compressed = false;
+
+    size_t i = hash & (slotCount - 1);
+    while (slots[i] != 0) {
+        i = (i + 1) & (slotCount - 1);
+    }
+    slots[i] = index + 1;
+
+    // The root is its own parent, everything else hangs off its directory
+    if (index != 0) {
+        uint32_t parent = ensure_directory(path, entry->baseOffset ? entry->baseOffset - 1 : 0);
+        if (parent == TAR_NO_ENTRY) {
+            return TAR_NO_ENTRY;
+        }
+        entry = &entries[index];
+        entry->parent = parent;
+        entry->nextSibling = entries[parent].firstChild;
+        entries[parent].firstChild = index;
+    } else {
+        entry->parent = 0;
+    }
+    return index;
+}
+
+uint32_t TarIndex::ensure_directory(const char* path, size_t length) {
+    uint32_t index = insert(path, length, true);
+    if (index != TAR_NO_ENTRY && !entries[index].file.is_directory) {
+        // A file path used as a directory, the archive is inconsistent so let the directory win
+        entries[index].file.is_directory = true;
+    }
+    return index;
+}
+
+bool TarIndex::build(const void* buffer, size_t size) {
+    release();
+    if (insert("", 0, true) == TAR_NO_ENTRY) {
+        return false;
+    }
+
+    const char* ptr = static_cast<const char*>(buffer);
+    const char* end = ptr + size;
+    char path[sizeof(tar_header::prefix) + 1 + sizeof(tar_header::name)];
+    // Set by a GNU 'L' record, the full path of the header right after it
+    const char* longName = nullptr;
+    size_t longNameLength = 0;
+    // Only images mkramfs marked as compressed get their ".lz4" files decoded, anywhere else they are plain files
+    bool compressedImage = false;
+
+    while (ptr + TAR_BLOCK_SIZE <= end) {
+        const struct tar_header* header = reinterpret_cast<const struct tar_header*>(ptr);
+        if (header->name[0] == '\0') {
+            break;
+        }
+
+        uint32_t file_size = octal_to_decimal(header->size, sizeof(header->size));
+        const char* data = ptr + TAR_BLOCK_SIZE;
+        // A truncated archive ends at the first entry whose data runs past the buffer
+        if (file_size > static_cast<size_t>(end - data)) {
+            break;
+        }
+        ptr += TAR_BLOCK_SIZE + ALIGN_UP(file_size, TAR_BLOCK_SIZE);
+
+        char typeflag = header->typeflag;
+        if (typeflag == 'L') {
+            longName = data;
+            longNameLength = bounded_length(data, file_size);
+            continue;
+        }
+        if (typeflag == 'g') {
+            compressedImage |= pax_has_record(data, file_size, TAR_PAX_COMPRESSION, "lz4");
+            continue;
+        }
+        const char* entryLongName = longName;
+        longName = nullptr;
+
+        // Regular files and directories only, pax headers and links carry no file data of their own
+        bool directory = typeflag == '5';
+        if (!directory && typeflag != '0' && typeflag != '\0') {
+            continue;
+        }
+
+        const char* normalized = path;
+        size_t length = 0;
+        if (entryLongName) {
+            // Points into the archive, insert copies it like any other name
+            normalized = entryLongName;
+            length = longNameLength;
+        } else {
+            if (memcmp(header->magic, "ustar", 5) == 0 && header->prefix[0]) {
+                size_t prefixLength = bounded_length(header->prefix, sizeof(header->prefix));
+                memcpy(path, header->prefix, prefixLength);
+                path[prefixLength] = '/';
+                length = prefixLength + 1;
+            }
+            size_t nameLength = bounded_length(header->name, sizeof(header->name));
+            memcpy(path + length, header->name, nameLength);
+            length += nameLength;
+        }
+        normalize(&normalized, &length);
+        if (length == 0) {
+            continue;
+        }
+
+        // Compressed images store every file as its own frame, the frame header carries the real size
+        uint64_t contentSize = file_size;
+        uint64_t frameSize;
+        bool compressed = false;
+        if (compressedImage && !directory && length > 4 && normalized[length - 5] != '/' && memcmp(normalized + length - 4, ".lz4", 4) == 0 &&
+            lz4_frame_content_size(data, file_size, &frameSize) && frameSize <= 0xFFFFFFFFull) {
+            contentSize = frameSize;
+            compressed = true;
+            length -= 4;
+        }
+
+        uint32_t index = directory ? ensure_directory(normalized, length) : insert(normalized, length, false);
+        if (index == TAR_NO_ENTRY) {
+            release();
+            return false;
+        }
+        if (!directory) {
+            // Later copies of a path replace earlier ones, like extracting the archive would
+            entries[index].file.size = contentSize;
+            entries[index].file.data = const_cast<char*>(data);
+            entries[index].storedSize = file_size;
+            entries[index].compressed = compressed;
+        }
+    }
+
+    // Children were prepended, flip every list back into archive order
+    for (size_t e = 0; e < count; e++) {
+        uint32_t previous = TAR_NO_ENTRY;
+        uint32_t child = entries[e].firstChild;
+        while (child != TAR_NO_ENTRY) {
+            uint32_t next = entries[child].nextSibling;
+            entries[child].nextSibling = previous;
+            previous = child;
+            child = next;
+        }
+        entries[e].firstChild = previous;
+    }
+    return true;
+}
+
+const tar_entry_t* TarIndex::lookup(const char* path, size_t length) const {
+    normalize(&path, &length);
+    uint32_t index = find(path, length, path_hash(path, length));
+    return index == TAR_NO_ENTRY ? nullptr : &entries[index];
+}
+
+const tar_entry_t* TarIndex::lookup(const char* path) const {
+    return lookup(path, strlen(path));
+}
+
+const tar_entry_t* TarIndex::lookup_child(const tar_entry_t* dir, const char* name, size_t length) const {
+    if (!dir || !dir->file.is_directory) {
+        return nullptr;
+    }
+    if (dir->nameLength == 0) {
+        return lookup(name, length);
+    }
+
+    // Hash the joined path incrementally instead of building it
+    uint64_t hash = dir->hash;
+    hash ^= '/';
+    hash *= 0x100000001B3ull;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 0x100000001B3ull;
+    }
+
+    size_t total = dir->nameLength + 1 + length;
+    size_t i = hash & (slotCount - 1);
+    while (slots[i] != 0) {
+        const tar_entry_t* entry = &entries[slots[i] - 1];
+        if (entry->hash == hash && entry->nameLength == total && entry->parent == static_cast<uint32_t>(dir - entries) &&
+            memcmp(entry->file.name + entry->baseOffset, name, length) == 0) {
+            return entry;
+        }
+        i = (i + 1) & (slotCount - 1);
+    }
+    return nullptr;
+}
+
+const tar_entry_t* TarIndex::root() const {
+    return count ? &entries[0] : nullptr;
+}
+
+const tar_entry_t* TarIndex::first_child(const tar_entry_t* dir) const {
+    return dir->firstChild == TAR_NO_ENTRY ? nullptr : &entries[dir->firstChild];
+}
+
+const tar_entry_t* TarIndex::next_sibling(const tar_entry_t* entry) const {
+    return entry->nextSibling == TAR_NO_ENTRY ? nullptr : &entries[entry->nextSibling];
+}
+
+size_t TarIndex::get_count() const {
+    return count;
+}
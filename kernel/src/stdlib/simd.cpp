@@ -0,0 +1,106 @@
+/*
+Sphynx Operating System
+
+File: simd.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: SIMD bulk memory routines
+*/
+
+#include <simd.hpp>
+#include <string.hpp>
+#include <sys/fpu.hpp>
+#include <sys/cpu.hpp>
+#include <core/mm/heap.hpp>
+
+// Saving and restoring the extended state costs about as much as copying this much with rep movsb
+#define SIMD_THRESHOLD 4096
+
+typedef long long v4u __attribute__((vector_size(32), aligned(1)));
+
+// Only called between kernel_fpu_begin and kernel_fpu_end, the rest of the kernel is built without SIMD
+__attribute__((target("avx2")))
+static void copy_avx2(unsigned char* d, const unsigned char* s, size_t n) {
+    while (n >= 128) {
+        v4u a = reinterpret_cast<const v4u*>(s)[0];
+        v4u b = reinterpret_cast<const v4u*>(s)[1];
+        v4u c = reinterpret_cast<const v4u*>(s)[2];
+        v4u e = reinterpret_cast<const v4u*>(s)[3];
+        reinterpret_cast<v4u*>(d)[0] = a;
+        reinterpret_cast<v4u*>(d)[1] = b;
+        reinterpret_cast<v4u*>(d)[2] = c;
+        reinterpret_cast<v4u*>(d)[3] = e;
+        d += 128;
+        s += 128;
+        n -= 128;
+    }
+    while (n >= 32) {
+        *reinterpret_cast<v4u*>(d) = *reinterpret_cast<const v4u*>(s);
+        d += 32;
+        s += 32;
+        n -= 32;
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+}
+
+void* simd_memcpy(void* dest, const void* src, size_t n) {
+    if (n < SIMD_THRESHOLD || !FPU::has_avx2()) {
+        return memcpy(dest, src, n);
+    }
+
+    kernel_fpu_begin();
+    copy_avx2(static_cast<unsigned char*>(dest), static_cast<const unsigned char*>(src), n);
+    kernel_fpu_end();
+    return dest;
+}
+
+void simd_self_test() {
+    const size_t size = 3 * SIMD_THRESHOLD;
+    static const size_t lengths[] = { 0, 31, SIMD_THRESHOLD - 1, SIMD_THRESHOLD, SIMD_THRESHOLD + 33, size - 32 };
+    unsigned char* src = static_cast<unsigned char*>(kmalloc(size + 64));
+    unsigned char* dst = static_cast<unsigned char*>(kmalloc(size + 64));
+    if (!src || !dst) {
+        kpanic(nullptr, "SIMD self test: out of memory");
+    }
+    for (size_t i = 0; i < size + 64; i++) {
+        src[i] = static_cast<unsigned char>(i * 7 + (i >> 8));
+    }
+
+    for (size_t n : lengths) {
+        for (size_t off = 0; off < 32; off += 15) {
+            memset(dst, 0xCC, size + 64);
+            simd_memcpy(dst + off, src + 32 - off, n);
+            if (memcmp(dst + off, src + 32 - off, n) != 0) {
+                kpanic(nullptr, "SIMD self test: simd_memcpy differs from memcpy");
+            }
+            if ((off && dst[off - 1] != 0xCC) || dst[off + n] != 0xCC) {
+                kpanic(nullptr, "SIMD self test: simd_memcpy wrote past the copy");
+            }
+        }
+    }
+    kfree(src);
+    kfree(dst);
+}
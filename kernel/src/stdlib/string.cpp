@@ -29,51 +29,439 @@ Description: POSIX C string functions
 */
 
 #include <string.hpp>
+#include <stdint.h>
+#include <math_utils.hpp>
+#include <sys/cpu.hpp>
+#if SPHYNX_STRING_SELF_TEST
+#include <sys/tsc.hpp>
+#include <dev/tty.hpp>
+#include <core/mm/pmm.hpp>
+#include <core/mm/vmm.hpp>
+#endif
 
-extern "C" void* memset(void* d, int c, size_t n) {
+// Unaligned 8 byte accesses are fine on x86, may_alias keeps them legal on any buffer type
+typedef uint64_t __attribute__((may_alias, aligned(1))) unaligned_u64;
+
+// Below this rep movsb/stosb startup costs more than a qword loop unless the CPU has FSRM
+#define REP_THRESHOLD 128
+
+static void* memcpy_qword(void* dest, const void* src, size_t n) {
+    unsigned char* p1 = static_cast<unsigned char*>(dest);
+    const unsigned char* p2 = static_cast<const unsigned char*>(src);
+    while (n >= 32) {
+        uint64_t a = reinterpret_cast<const unaligned_u64*>(p2)[0];
+        uint64_t b = reinterpret_cast<const unaligned_u64*>(p2)[1];
+        uint64_t c = reinterpret_cast<const unaligned_u64*>(p2)[2];
+        uint64_t d = reinterpret_cast<const unaligned_u64*>(p2)[3];
+        reinterpret_cast<unaligned_u64*>(p1)[0] = a;
+        reinterpret_cast<unaligned_u64*>(p1)[1] = b;
+        reinterpret_cast<unaligned_u64*>(p1)[2] = c;
+        reinterpret_cast<unaligned_u64*>(p1)[3] = d;
+        p1 += 32;
+        p2 += 32;
+        n -= 32;
+    }
+    while (n >= 8) {
+        *reinterpret_cast<unaligned_u64*>(p1) = *reinterpret_cast<const unaligned_u64*>(p2);
+        p1 += 8;
+        p2 += 8;
+        n -= 8;
+    }
+    while (n--) {
+        *p1++ = *p2++;
+    }
+    return dest;
+}
+
+// Without ERMS rep movsq is still the fastest string move, the tail goes byte wise
+static void* memcpy_movsq(void* dest, const void* src, size_t n) {
+    if (n < REP_THRESHOLD) {
+        return memcpy_qword(dest, src, n);
+    }
+    void* d = dest;
+    size_t qwords = n / 8;
+    size_t tail = n % 8;
+    __asm__ volatile("rep movsq" : "+D"(d), "+S"(src), "+c"(qwords) : : "memory");
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(tail) : : "memory");
+    return dest;
+}
+
+static void* memcpy_erms(void* dest, const void* src, size_t n) {
+    if (n < REP_THRESHOLD) {
+        return memcpy_qword(dest, src, n);
+    }
+    void* d = dest;
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+    return dest;
+}
+
+static void* memcpy_fsrm(void* dest, const void* src, size_t n) {
+    void* d = dest;
+    __asm__ volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+    return dest;
+}
+
+static void* memset_qword(void* d, int c, size_t n) {
     unsigned char* p = static_cast<unsigned char*>(d);
+    uint64_t pattern = 0x0101010101010101ull * static_cast<unsigned char>(c);
+    while (n >= 32) {
+        reinterpret_cast<unaligned_u64*>(p)[0] = pattern;
+        reinterpret_cast<unaligned_u64*>(p)[1] = pattern;
+        reinterpret_cast<unaligned_u64*>(p)[2] = pattern;
+        reinterpret_cast<unaligned_u64*>(p)[3] = pattern;
+        p += 32;
+        n -= 32;
+    }
+    while (n >= 8) {
+        *reinterpret_cast<unaligned_u64*>(p) = pattern;
+        p += 8;
+        n -= 8;
+    }
     while (n--) {
         *p++ = static_cast<unsigned char>(c);
     }
     return d;
 }
 
+static void* memset_stosq(void* d, int c, size_t n) {
+    if (n < REP_THRESHOLD) {
+        return memset_qword(d, c, n);
+    }
+    void* p = d;
+    uint64_t pattern = 0x0101010101010101ull * static_cast<unsigned char>(c);
+    size_t qwords = n / 8;
+    size_t tail = n % 8;
+    __asm__ volatile("rep stosq" : "+D"(p), "+c"(qwords) : "a"(pattern) : "memory");
+    __asm__ volatile("rep stosb" : "+D"(p), "+c"(tail) : "a"(pattern) : "memory");
+    return d;
+}
+
+static void* memset_erms(void* d, int c, size_t n) {
+    if (n < REP_THRESHOLD) {
+        return memset_qword(d, c, n);
+    }
+    void* p = d;
+    __asm__ volatile("rep stosb" : "+D"(p), "+c"(n) : "a"(c) : "memory");
+    return d;
+}
+
+static void* memset_fsrm(void* d, int c, size_t n) {
+    void* p = d;
+    __asm__ volatile("rep stosb" : "+D"(p), "+c"(n) : "a"(c) : "memory");
+    return d;
+}
+
+typedef void* (*memcpy_t)(void*, const void*, size_t);
+typedef void* (*memset_t)(void*, int, size_t);
+
+// The portable variants are safe on any CPU, string_init swaps in the best one
+static memcpy_t memcpyImpl = memcpy_qword;
+static memset_t memsetImpl = memset_qword;
+static const char* memVariant = "qword";
+static bool hasErms = false;
+static bool hasFsrm = false;
+
+extern "C" void* memset(void* d, int c, size_t n) {
+    return memsetImpl(d, c, n);
+}
+
 extern "C" void* memcpy(void* dest, const void* src, size_t n) {
+    return memcpyImpl(dest, src, n);
+}
+
+extern "C" void* memmove(void* dest, const void* src, size_t n) {
     unsigned char* p1 = static_cast<unsigned char*>(dest);
     const unsigned char* p2 = static_cast<const unsigned char*>(src);
+
+    // A forward copy is only wrong when dest starts inside the source
+    if (p1 <= p2 || p1 >= p2 + n) {
+        return memcpyImpl(dest, src, n);
+    }
+
+    // Backward copy, rep movsb with DF set is slow on every CPU so this stays a qword loop
+    p1 += n;
+    p2 += n;
+    while (n >= 8) {
+        p1 -= 8;
+        p2 -= 8;
+        n -= 8;
+        *reinterpret_cast<unaligned_u64*>(p1) = *reinterpret_cast<const unaligned_u64*>(p2);
+    }
     while (n--) {
-        *p1++ = *p2++;
+        *--p1 = *--p2;
     }
     return dest;
 }
 
-extern "C" void* memmove(void* dest, const void* src, size_t n) {
+void string_init() {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    uint32_t maxLeaf = eax;
+
+    if (maxLeaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        hasErms = ebx & (1 << 9);
+        hasFsrm = edx & (1 << 4);
+    }
+
+    if (hasFsrm) {
+        memcpyImpl = memcpy_fsrm;
+        memsetImpl = memset_fsrm;
+        memVariant = "fsrm";
+    } else if (hasErms) {
+        memcpyImpl = memcpy_erms;
+        memsetImpl = memset_erms;
+        memVariant = "erms";
+    } else {
+        memcpyImpl = memcpy_movsq;
+        memsetImpl = memset_stosq;
+        memVariant = "movsq";
+    }
+}
+
+const char* string_get_variant() {
+    return memVariant;
+}
+
+#if SPHYNX_STRING_SELF_TEST
+// Byte at a time baselines, only measured against the real variants
+static void* memcpy_byte(void* dest, const void* src, size_t n) {
     unsigned char* p1 = static_cast<unsigned char*>(dest);
     const unsigned char* p2 = static_cast<const unsigned char*>(src);
+    while (n--) {
+        *p1++ = *p2++;
+    }
+    return dest;
+}
+
+static void* memset_byte(void* d, int c, size_t n) {
+    unsigned char* p = static_cast<unsigned char*>(d);
+    while (n--) {
+        *p++ = static_cast<unsigned char>(c);
+    }
+    return d;
+}
+
+static void check_copies(memcpy_t copy, memset_t set, unsigned char* a, unsigned char* b) {
+    for (size_t n = 0; n < 300; n++) {
+        for (size_t off = 0; off < 8; off++) {
+            for (size_t i = 0; i < n + 16; i++) {
+                a[i] = static_cast<unsigned char>(i * 7 + n);
+                b[i] = 0xAA;
+            }
+            copy(b + off, a + (7 - off), n);
+            for (size_t i = 0; i < n + 16; i++) {
+                unsigned char want = (i >= off && i < off + n) ? a[i - off + 7 - off] : 0xAA;
+                if (b[i] != want) {
+                    kpanic(nullptr, "memcpy self test produced wrong data");
+                }
+            }
 
-    if (p1 < p2) {
-        while (n--) {
-            *p1++ = *p2++;
+            set(b + off, static_cast<int>(n), n);
+            for (size_t i = 0; i < n + 16; i++) {
+                unsigned char want = (i >= off && i < off + n) ? static_cast<unsigned char>(n) : 0xAA;
+                if (b[i] != want) {
+                    kpanic(nullptr, "memset self test produced wrong data");
+                }
+            }
         }
-    } else {
-        p1 += n;
-        p2 += n;
-        while (n--) {
-            *--p1 = *--p2;
+    }
+}
+
+static void check_memmove(unsigned char* a) {
+    for (size_t n = 1; n < 200; n += 3) {
+        for (size_t shift = 1; shift < 20; shift++) {
+            for (size_t i = 0; i < n + shift; i++) {
+                a[i] = static_cast<unsigned char>(i);
+            }
+            // Overlapping with dest above src forces the backward path
+            memmove(a + shift, a, n);
+            for (size_t i = 0; i < n; i++) {
+                if (a[i + shift] != static_cast<unsigned char>(i)) {
+                    kpanic(nullptr, "memmove self test failed copying backward");
+                }
+            }
+
+            for (size_t i = 0; i < n + shift; i++) {
+                a[i] = static_cast<unsigned char>(i);
+            }
+            memmove(a, a + shift, n);
+            for (size_t i = 0; i < n; i++) {
+                if (a[i] != static_cast<unsigned char>(i + shift)) {
+                    kpanic(nullptr, "memmove self test failed copying forward");
+                }
+            }
         }
     }
-    return dest;
+}
+
+// Hundredths of a GB/s, bytes per nanosecond is GB/s
+static uint64_t rate(uint64_t bytes, uint64_t ticks) {
+    uint64_t ns = TSC::ticks_to_ns(ticks);
+    return ns == 0 ? 0 : bytes * 100 / ns;
+}
+
+void string_self_test() {
+    Logger logger("String");
+    const uint64_t bufferPages = 256;
+    unsigned char* phys1 = static_cast<unsigned char*>(PMM::request_pages(bufferPages));
+    unsigned char* phys2 = static_cast<unsigned char*>(PMM::request_pages(bufferPages));
+    if (!phys1 || !phys2) {
+        logger.log(Logger::Level::WARN, "Not enough memory for the string self test\n");
+        PMM::free_pages(phys1);
+        PMM::free_pages(phys2);
+        return;
+    }
+    unsigned char* a = static_cast<unsigned char*>(VMM::phys_to_virt(reinterpret_cast<uint64_t>(phys1)));
+    unsigned char* b = static_cast<unsigned char*>(VMM::phys_to_virt(reinterpret_cast<uint64_t>(phys2)));
+
+    // Feature bits come from string_init, which checks the highest CPUID leaf first
+    struct {
+        const char* name;
+        memcpy_t copy;
+        memset_t set;
+        bool usable;
+    } variants[] = {
+        { "byte", memcpy_byte, memset_byte, true },
+        { "qword", memcpy_qword, memset_qword, true },
+        { "movsq", memcpy_movsq, memset_stosq, true },
+        { "erms", memcpy_erms, memset_erms, hasErms },
+        { "fsrm", memcpy_fsrm, memset_fsrm, hasFsrm },
+    };
+    const uint64_t sizes[] = { 64, 256, 4096, 65536, 1048576 };
+    // Bytes moved per measurement, enough to dwarf the TSC read overhead
+    const uint64_t volume = 4 * 1024 * 1024;
+
+    check_memmove(a);
+    for (auto& variant : variants) {
+        if (!variant.usable) {
+            continue;
+        }
+        check_copies(variant.copy, variant.set, a, b);
+
+        for (uint64_t size : sizes) {
+            uint64_t rounds = volume / size;
+            uint64_t start = TSC::read();
+            for (uint64_t i = 0; i < rounds; i++) {
+                variant.copy(b, a, size);
+            }
+            uint64_t copyTicks = TSC::read() - start;
+
+            start = TSC::read();
+            for (uint64_t i = 0; i < rounds; i++) {
+                variant.set(b, static_cast<int>(i), size);
+            }
+            uint64_t setTicks = TSC::read() - start;
+
+            uint64_t copyRate = rate(volume, copyTicks);
+            uint64_t setRate = rate(volume, setTicks);
+            logger.log(Logger::Level::INFO, "%-5s %7llu bytes: memcpy %llu.%02llu GB/s, memset %llu.%02llu GB/s\n",
+                variant.name, size, copyRate / 100, copyRate % 100, setRate / 100, setRate % 100);
+        }
+    }
+
+    logger.log(Logger::Level::INFO, "String self test passed, using the %s variants\n", memVariant);
+    PMM::free_pages(phys1);
+    PMM::free_pages(phys2);
+}
+#endif
+
+// Word at a time scanning, reads are 8 byte aligned so they never cross into an unmapped page
+#define ONES 0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+// Lowest set high bit marks the first zero byte exactly, higher ones can be false positives
+static inline uint64_t has_zero(uint64_t v) {
+    return (v - ONES) & ~v & HIGHS;
+}
+
+static inline uint64_t first_byte(uint64_t mask) {
+    return __builtin_ctzll(mask) / 8;
+}
+
+static inline bool is_aligned(const void* p) {
+    return (reinterpret_cast<uintptr_t>(p) & 7) == 0;
+}
+
+extern "C" int memcmp(const void* s1, const void* s2, size_t n) {
+    const unsigned char* p1 = static_cast<const unsigned char*>(s1);
+    const unsigned char* p2 = static_cast<const unsigned char*>(s2);
+    while (n >= 8 && *reinterpret_cast<const unaligned_u64*>(p1) == *reinterpret_cast<const unaligned_u64*>(p2)) {
+        p1 += 8;
+        p2 += 8;
+        n -= 8;
+    }
+    while (n--) {
+        if (*p1 != *p2) {
+            return *p1 - *p2;
+        }
+        ++p1;
+        ++p2;
+    }
+    return 0;
 }
 
 extern "C" size_t strlen(const char* s) {
     const char* p = s;
-    while (*p) {
+    while (!is_aligned(p)) {
+        if (!*p) {
+            return p - s;
+        }
         ++p;
     }
-    return p - s;
+
+    const uint64_t* w = reinterpret_cast<const uint64_t*>(p);
+    uint64_t mask;
+    while (!(mask = has_zero(*w))) {
+        ++w;
+    }
+    return reinterpret_cast<const char*>(w) + first_byte(mask) - s;
+}
+
+// Number of leading bytes that are equal and not NUL, checked 8 at a time, at most limit rounded down to words
+static size_t equal_prefix(const char* s1, const char* s2, size_t limit) {
+    size_t i = 0;
+    while (!is_aligned(s1 + i)) {
+        if (i == limit || s1[i] != s2[i] || !s1[i]) {
+            return i;
+        }
+        ++i;
+    }
+
+    const uint64_t* p1 = reinterpret_cast<const uint64_t*>(s1 + i);
+    uintptr_t shift = reinterpret_cast<uintptr_t>(s2 + i) & 7;
+    const uint64_t* p2 = reinterpret_cast<const uint64_t*>(s2 + i - shift);
+
+    if (shift == 0) {
+        while (limit - i >= 8 && *p1 == *p2 && !has_zero(*p1)) {
+            ++p1;
+            ++p2;
+            i += 8;
+        }
+        return i;
+    }
+
+    // s2 is misaligned, build its words from two aligned loads and only load the next one once
+    // the current one is known to hold no NUL
+    uint64_t lowMask = (1ull << (shift * 8)) - 1;
+    uint64_t lo = *p2;
+    while (limit - i >= 8 && !has_zero(lo | lowMask)) {
+        uint64_t hi = *++p2;
+        uint64_t w2 = (lo >> (shift * 8)) | (hi << (64 - shift * 8));
+        if (*p1 != w2 || has_zero(*p1)) {
+            break;
+        }
+        ++p1;
+        i += 8;
+        lo = hi;
+    }
+    return i;
 }
 
 extern "C" int strcmp(const char* s1, const char* s2) {
+    size_t i = equal_prefix(s1, s2, static_cast<size_t>(-1));
+    s1 += i;
+    s2 += i;
     while (*s1 && (*s1 == *s2)) {
         ++s1;
         ++s2;
@@ -82,51 +470,191 @@ extern "C" int strcmp(const char* s1, const char* s2) {
 }
 
 extern "C" char* strcpy(char* dest, const char* src) {
-    char* d = dest;
-    while ((*d++ = *src++));
+    memcpy(dest, src, strlen(src) + 1);
     return dest;
 }
 
 extern "C" char* strcat(char* dest, const char* src) {
-    char* d = dest;
-    while (*d) {
-        ++d;
-    }
-    while ((*d++ = *src++));
+    strcpy(dest + strlen(dest), src);
     return dest;
 }
 
 extern "C" const char* strchr(const char* s, int c) {
-    while (*s) {
-        if (*s == static_cast<char>(c)) {
+    char ch = static_cast<char>(c);
+    while (!is_aligned(s)) {
+        if (*s == ch) {
             return s;
         }
+        if (!*s) {
+            return nullptr;
+        }
         ++s;
     }
-    return nullptr;
+
+    uint64_t pattern = ONES * static_cast<unsigned char>(ch);
+    const uint64_t* w = reinterpret_cast<const uint64_t*>(s);
+    while (!has_zero(*w) && !has_zero(*w ^ pattern)) {
+        ++w;
+    }
+
+    // Either the terminator or c is in this word, whichever comes first decides
+    for (s = reinterpret_cast<const char*>(w); ; ++s) {
+        if (*s == ch) {
+            return s;
+        }
+        if (!*s) {
+            return nullptr;
+        }
+    }
 }
 
 extern "C" const char* strrchr(const char* s, int c) {
+    char ch = static_cast<char>(c);
+    if (ch == '\0') {
+        return s + strlen(s);
+    }
+
     const char* last_occurrence = nullptr;
-    while (*s) {
-        if (*s == static_cast<char>(c)) {
+    while (!is_aligned(s)) {
+        if (!*s) {
+            return last_occurrence;
+        }
+        if (*s == ch) {
             last_occurrence = s;
         }
         ++s;
     }
+
+    // Only remember the last word holding c, it gets resolved byte wise once the end is found
+    uint64_t pattern = ONES * static_cast<unsigned char>(ch);
+    const uint64_t* w = reinterpret_cast<const uint64_t*>(s);
+    const char* candidate = nullptr;
+    while (!has_zero(*w)) {
+        if (has_zero(*w ^ pattern)) {
+            candidate = reinterpret_cast<const char*>(w);
+        }
+        ++w;
+    }
+    if (candidate) {
+        for (int i = 0; i < 8; i++) {
+            if (candidate[i] == ch) {
+                last_occurrence = candidate + i;
+            }
+        }
+    }
+
+    for (s = reinterpret_cast<const char*>(w); *s; ++s) {
+        if (*s == ch) {
+            last_occurrence = s;
+        }
+    }
     return last_occurrence;
 }
 
+// Two-Way string matching (Crochemore and Perrin), linear time and constant space
 extern "C" const char* strstr(const char* haystack, const char* needle) {
     if (!*needle) {
         return haystack;
     }
-    for (; *haystack; ++haystack) {
-        if ((*haystack == *needle) && (strcmp(haystack, needle) == 0)) {
-            return haystack;
+    haystack = strchr(haystack, *needle);
+    if (!haystack || !needle[1]) {
+        return haystack;
+    }
+
+    const unsigned char* h = reinterpret_cast<const unsigned char*>(haystack);
+    const unsigned char* n = reinterpret_cast<const unsigned char*>(needle);
+    size_t l = strlen(needle);
+
+    // Critical factorization from the maximal suffixes under both orderings
+    size_t ip = static_cast<size_t>(-1), jp = 0, k = 1, p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] > n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    size_t ms = ip;
+    size_t p0 = p;
+
+    ip = static_cast<size_t>(-1);
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] < n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    if (ip + 1 > ms + 1) {
+        ms = ip;
+    } else {
+        p = p0;
+    }
+
+    // A periodic needle remembers how much of the left half already matched
+    size_t mem0;
+    if (memcmp(n, n + p, ms + 1) != 0) {
+        mem0 = 0;
+        p = MAX(ms, l - ms - 1) + 1;
+    } else {
+        mem0 = l - p;
+    }
+    size_t mem = 0;
+
+    // The haystack length is discovered lazily so matches near the start stay cheap
+    const unsigned char* z = h;
+    bool ended = false;
+    while (true) {
+        if (static_cast<size_t>(z - h) < l) {
+            if (!ended) {
+                size_t grow = l | 63;
+                while (grow && *z) {
+                    ++z;
+                    --grow;
+                }
+                ended = !*z;
+            }
+            if (static_cast<size_t>(z - h) < l) {
+                return nullptr;
+            }
+        }
+
+        for (k = MAX(ms + 1, mem); k < l && n[k] == h[k]; k++);
+        if (k < l) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+
+        for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--);
+        if (k <= mem) {
+            return reinterpret_cast<const char*>(h);
         }
+        h += p;
+        mem = mem0;
     }
-    return nullptr;
 }
 
 extern "C" char* strncpy(char* dest, const char* src, size_t n) {
@@ -143,6 +671,10 @@ extern "C" char* strncpy(char* dest, const char* src, size_t n) {
 }
 
 extern "C" int strncmp(const char* s1, const char* s2, size_t n) {
+    size_t i = equal_prefix(s1, s2, n);
+    s1 += i;
+    s2 += i;
+    n -= i;
     while (n && *s1 && (*s1 == *s2)) {
         ++s1;
         ++s2;
@@ -31,8 +31,18 @@ Description: Common CPU functions and utilities
 #include <sys/cpu.hpp>
 #include <dev/tty.hpp>
 #include <string.hpp>
+#include <core/mm/vmm.hpp>
+#include <sys/trace.hpp>
 
 void _kpanic_handler(IDT::int_frame_t *frame, const char* file, int line, const char* reason) {
+    // Software panics can come with interrupts on. Nothing may run after us, and output has to be polled out
+    // because the UART interrupt that would drain its ring never comes
+    __asm__ volatile("cli");
+
+    // Get whatever led up to the panic out before the panic report itself
+    KLog::panic_flush();
+    Trace::dump();
+
     #if SPHYNX_SIMPLE_PANIC
     KMPRINTF("\033[31mKernel Panic @ CPU %s (0x%.16llx), Reason: \"%s\", %s:%d\n", "???", (frame == nullptr) ? 0x0 : frame->rip, reason, file, line);
     #else
@@ -88,6 +98,9 @@ void _kpanic_handler(IDT::int_frame_t *frame, const char* file, int line, const
         DPRINTF("\033[31m  Privilege Level: %s\033[0m\n", (frame->err & 0x4) ? "User Mode" : "Supervisor Mode");
         if (frame->err & 0x8) DPRINTF("\033[31m  Reserved Write: Yes\033[0m\n");
         if (frame->err & 0x10) DPRINTF("\033[31m  Instruction Fetch: Yes\033[0m\n");
+
+        VMM::fault_stats_t faults = VMM::get_fault_stats();
+        DPRINTF("\033[31m  Faults so far: %llu minor, %llu CoW, %llu fatal\033[0m\n", faults.minor, faults.cow, faults.fatal);
     }
 
     KMPRINTF("\033[31mStack trace:\033[0m\n");
@@ -95,5 +108,6 @@ void _kpanic_handler(IDT::int_frame_t *frame, const char* file, int line, const
 
     #endif
 
+    Console::flush();
     hcf();
 }
@@ -0,0 +1,213 @@
+/*
+Sphynx Operating System
+
+File: fpu.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: FPU, SSE and AVX state management
+*/
+
+#include <sys/fpu.hpp>
+#include <sys/cpu.hpp>
+#include <sys/percpu.hpp>
+#include <core/mm/early.hpp>
+#include <string.hpp>
+
+namespace FPU {
+    static bool useXsave = false;
+    static bool useXsaveopt = false;
+    static bool avx = false;
+    static bool avx2 = false;
+    static uint32_t stateSize = 512;
+    static uint64_t stateMask = XCR0_X87 | XCR0_SSE;
+
+    static inline void xsetbv(uint32_t index, uint64_t value) {
+        __asm__ volatile("xsetbv" : : "c"(index), "a"(static_cast<uint32_t>(value)), "d"(static_cast<uint32_t>(value >> 32)));
+    }
+
+    static inline void clts() {
+        __asm__ volatile("clts");
+    }
+
+    static inline void stts() {
+        write_cr0(read_cr0() | CR0_TS);
+    }
+
+    void init() {
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+        uint32_t maxLeaf = eax;
+
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        if (!(edx & (1 << 25)) || !(edx & (1 << 26))) {
+            kpanic(nullptr, "CPU lacks SSE2");
+        }
+        bool xsave = ecx & (1 << 26);
+        bool cpuAvx = ecx & (1 << 28);
+
+        write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+        uint64_t cr4 = read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT;
+        if (xsave) {
+            cr4 |= CR4_OSXSAVE;
+        }
+        write_cr4(cr4);
+
+        if (xsave) {
+            useXsave = true;
+            if (cpuAvx) {
+                stateMask |= XCR0_AVX;
+                avx = true;
+                if (maxLeaf >= 7) {
+                    cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+                    avx2 = ebx & (1 << 5);
+                }
+            }
+            xsetbv(0, stateMask);
+
+            // EBX reports the area size for the features enabled in XCR0
+            cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+            stateSize = ebx;
+            cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+            useXsaveopt = eax & 1;
+        }
+
+        __asm__ volatile("fninit");
+
+        PerCPU::cpu_t* cpu = PerCPU::current();
+        cpu->fpuArea = Early::alloc(stateSize, 64);
+        cpu->fpuDepth = 0;
+
+        // Any SIMD instruction outside a kernel_fpu section now raises #NM
+        stts();
+    }
+
+    bool has_avx() {
+        return avx;
+    }
+
+    bool has_avx2() {
+        return avx2;
+    }
+
+    uint32_t get_state_size() {
+        return stateSize;
+    }
+
+    // The widest vector register there is, ymm0 with AVX and xmm0 otherwise
+    static void read_vector(uint8_t* out) {
+        if (avx) {
+            __asm__ volatile("vmovdqu %%ymm0, (%0)" : : "r"(out) : "memory");
+        } else {
+            __asm__ volatile("movdqu %%xmm0, (%0)" : : "r"(out) : "memory");
+        }
+    }
+
+    static void write_vector(const uint8_t* in) {
+        if (avx) {
+            __asm__ volatile("vmovdqu (%0), %%ymm0" : : "r"(in) : "memory");
+        } else {
+            __asm__ volatile("movdqu (%0), %%xmm0" : : "r"(in) : "memory");
+        }
+    }
+
+    void self_test() {
+        uint8_t before[32];
+        uint8_t pattern[32];
+        uint8_t after[32];
+        size_t width = avx ? 32 : 16;
+
+        // Whatever a section leaves in the registers must be gone once the next one starts
+        kernel_fpu_begin();
+        read_vector(before);
+        for (size_t i = 0; i < width; i++) {
+            pattern[i] = ~before[i];
+        }
+        write_vector(pattern);
+        kernel_fpu_end();
+
+        kernel_fpu_begin();
+        read_vector(after);
+        kernel_fpu_end();
+        if (memcmp(before, after, width) != 0) {
+            kpanic(nullptr, "FPU self test: kernel_fpu_end didn't restore the vector registers");
+        }
+    }
+
+    // XSAVEOPT skips components that are still in their initial state or unchanged since the last XRSTOR
+    static inline void save(void* area) {
+        uint32_t lo = static_cast<uint32_t>(stateMask);
+        uint32_t hi = static_cast<uint32_t>(stateMask >> 32);
+        if (useXsaveopt) {
+            __asm__ volatile("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+        } else if (useXsave) {
+            __asm__ volatile("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+        } else {
+            __asm__ volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+        }
+    }
+
+    static inline void restore(void* area) {
+        uint32_t lo = static_cast<uint32_t>(stateMask);
+        uint32_t hi = static_cast<uint32_t>(stateMask >> 32);
+        if (useXsave) {
+            __asm__ volatile("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+        } else {
+            __asm__ volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+        }
+    }
+
+    static void begin() {
+        uint64_t flags = irq_save();
+        PerCPU::cpu_t* cpu = PerCPU::current();
+        if (cpu->fpuDepth++ != 0) {
+            return;
+        }
+
+        cpu->fpuFlags = flags;
+        clts();
+        save(cpu->fpuArea);
+    }
+
+    static void end() {
+        PerCPU::cpu_t* cpu = PerCPU::current();
+        if (cpu->fpuDepth == 0) {
+            kpanic(nullptr, "kernel_fpu_end without kernel_fpu_begin");
+        }
+        if (--cpu->fpuDepth != 0) {
+            return;
+        }
+
+        restore(cpu->fpuArea);
+        stts();
+        irq_restore(cpu->fpuFlags);
+    }
+}
+
+void kernel_fpu_begin() {
+    FPU::begin();
+}
+
+void kernel_fpu_end() {
+    FPU::end();
+}
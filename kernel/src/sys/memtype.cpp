@@ -0,0 +1,163 @@
+/*
+Sphynx Operating System
+
+File: memtype.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Memory types through the PAT and MTRRs
+*/
+
+#include <sys/memtype.hpp>
+#include <sys/cpu.hpp>
+#include <core/mm/vmm.hpp>
+#include <dev/tty.hpp>
+
+namespace MemType {
+    #define PAT_ENTRY(index, type) (static_cast<uint64_t>(type) << ((index) * 8))
+    #define MTRR_ENABLE (1ull << 11)
+    #define MTRR_FIXED_ENABLE (1ull << 10)
+    #define MTRR_VALID (1ull << 11)
+
+    // Slots 0-3 keep their reset values so PWT and PCD alone still mean what they always did
+    static const uint64_t patValue = PAT_ENTRY(0, WB) | PAT_ENTRY(1, WT) | PAT_ENTRY(2, UC_MINUS) | PAT_ENTRY(3, UC) |
+        PAT_ENTRY(4, WC) | PAT_ENTRY(5, WP) | PAT_ENTRY(6, UC_MINUS) | PAT_ENTRY(7, UC);
+
+    static bool pat = false;
+    static bool mtrr = false;
+
+    void init() {
+        Logger logger("MemType");
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+        pat = edx & (1 << 16);
+        mtrr = edx & (1 << 12);
+
+        if (!pat) {
+            logger.log(Logger::Level::WARN, "No PAT, write-combining mappings fall back to uncached\n");
+            return;
+        }
+
+        // The caches have to be off and empty while the PAT changes, then every TLB entry built on the old one goes
+        uint64_t flags = irq_save();
+        uint64_t cr0 = read_cr0();
+        write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+        __asm__ volatile("wbinvd" : : : "memory");
+        wrmsr(MSR_PAT, patValue);
+        __asm__ volatile("wbinvd" : : : "memory");
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 ^ CR4_PGE);
+        write_cr4(cr4);
+        write_cr3(read_cr3());
+        write_cr0(cr0);
+        irq_restore(flags);
+
+        logger.log(Logger::Level::INFO, "PAT programmed, MTRRs %s\n", mtrr ? "present" : "absent");
+    }
+
+    bool has_pat() {
+        return pat;
+    }
+
+    uint64_t pte_flags(Type type) {
+        switch (type) {
+            case WB:
+                return 0;
+            case WT:
+                return PTE_PWT;
+            case UC_MINUS:
+                return PTE_PCD;
+            case UC:
+                return PTE_PCD | PTE_PWT;
+            case WC:
+                return pat ? PTE_PAT_4K : PTE_PCD;
+            case WP:
+                return pat ? PTE_PAT_4K | PTE_PWT : PTE_PCD | PTE_PWT;
+        }
+        return PTE_PCD | PTE_PWT;
+    }
+
+    Type mtrr_type(uint64_t phys) {
+        if (!mtrr) {
+            return UC;
+        }
+        uint64_t defType = rdmsr(MSR_MTRR_DEF_TYPE);
+        if (!(defType & MTRR_ENABLE)) {
+            return UC;
+        }
+
+        // The fixed range MTRRs of the first megabyte aren't decoded, nothing that cares about its type lives there
+        if (phys < 0x100000 && (defType & MTRR_FIXED_ENABLE)) {
+            return UC;
+        }
+
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+        uint32_t physBits = 36;
+        if (eax >= 0x80000008) {
+            cpuid(0x80000008, 0, &eax, &ebx, &ecx, &edx);
+            physBits = eax & 0xFF;
+        }
+        uint64_t addrMask = ((1ull << physBits) - 1) & ~0xFFFull;
+
+        // Overlapping ranges resolve to UC if any says UC, and to WT when WT meets WB
+        uint64_t count = rdmsr(MSR_MTRR_CAP) & 0xFF;
+        int found = -1;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t mask = rdmsr(MSR_MTRR_PHYS_MASK + i * 2);
+            if (!(mask & MTRR_VALID)) {
+                continue;
+            }
+            uint64_t base = rdmsr(MSR_MTRR_PHYS_BASE + i * 2);
+            mask &= addrMask;
+            if ((phys & mask) != (base & mask)) {
+                continue;
+            }
+
+            int type = base & 0xFF;
+            if (found == -1 || type == UC || (type == WT && found == WB)) {
+                found = found == UC ? UC : type;
+            }
+        }
+
+        return static_cast<Type>(found == -1 ? defType & 0xFF : found);
+    }
+
+    const char* name(Type type) {
+        switch (type) {
+            case UC:
+                return "UC";
+            case WC:
+                return "WC";
+            case WT:
+                return "WT";
+            case WP:
+                return "WP";
+            case WB:
+                return "WB";
+            case UC_MINUS:
+                return "UC-";
+        }
+        return "?";
+    }
+}
@@ -0,0 +1,44 @@
+/*
+Sphynx Operating System
+
+File: percpu.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Per CPU data
+*/
+
+#include <sys/percpu.hpp>
+#include <sys/cpu.hpp>
+
+namespace PerCPU {
+    static_assert(__builtin_offsetof(cpu_t, id) == 8, "PerCPU::id() reads gs:8");
+
+    static cpu_t cpus[SPHYNX_MAX_CPUS];
+
+    void init_bsp() {
+        cpus[0].self = &cpus[0];
+        cpus[0].id = 0;
+        wrmsr(MSR_GS_BASE, reinterpret_cast<uint64_t>(&cpus[0]));
+    }
+}
@@ -0,0 +1,99 @@
+/*
+Sphynx Operating System
+
+File: static_key.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Static keys, branches patched in the kernel text instead of tested at runtime
+*/
+
+#include <sys/static_key.hpp>
+#include <sys/cpu.hpp>
+#include <sys/spinlock.hpp>
+#include <core/mm/vmm.hpp>
+
+extern "C" jump_entry_t __jump_table_start[];
+extern "C" jump_entry_t __jump_table_end[];
+
+namespace StaticKey {
+    #define JUMP_SIZE 5
+
+    static const uint8_t nop[JUMP_SIZE] = { 0x0F, 0x1F, 0x44, 0x00, 0x00 };
+    static Spinlock lock;
+
+    // The text is mapped read-only, so each byte goes through its direct map alias. A site may straddle two pages
+    static bool patch(const jump_entry_t* entry, bool enabled) {
+        uint8_t code[JUMP_SIZE];
+        if (enabled) {
+            int32_t offset = static_cast<int32_t>(entry->target - (entry->code + JUMP_SIZE));
+            code[0] = 0xE9;
+            __builtin_memcpy(code + 1, &offset, sizeof(offset));
+        } else {
+            __builtin_memcpy(code, nop, JUMP_SIZE);
+        }
+
+        uint8_t* alias[JUMP_SIZE];
+        for (int i = 0; i < JUMP_SIZE; i++) {
+            uint64_t phys = VMM::translate(VMM::kernel_space(), entry->code + i);
+            if (phys == 0) {
+                return false;
+            }
+            alias[i] = static_cast<uint8_t*>(VMM::phys_to_virt(phys));
+        }
+
+        // Only the boot CPU runs, so nothing can execute the site while it is half written as long as interrupts are off
+        uint64_t flags = irq_save();
+        for (int i = 0; i < JUMP_SIZE; i++) {
+            *reinterpret_cast<volatile uint8_t*>(alias[i]) = code[i];
+        }
+        // Serializes the instruction stream so the old bytes can't still be prefetched
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+        irq_restore(flags);
+        return true;
+    }
+
+    static uint64_t update(static_key_t* key, bool enabled) {
+        lock.lock();
+        uint64_t patched = 0;
+        if (__atomic_load_n(&key->enabled, __ATOMIC_RELAXED) != enabled) {
+            for (jump_entry_t* entry = __jump_table_start; entry < __jump_table_end; entry++) {
+                if (entry->key == reinterpret_cast<uint64_t>(key) && patch(entry, enabled)) {
+                    patched++;
+                }
+            }
+            __atomic_store_n(&key->enabled, enabled, __ATOMIC_RELAXED);
+        }
+        lock.unlock();
+        return patched;
+    }
+
+    uint64_t enable(static_key_t* key) {
+        return update(key, true);
+    }
+
+    uint64_t disable(static_key_t* key) {
+        return update(key, false);
+    }
+}
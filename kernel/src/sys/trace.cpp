@@ -0,0 +1,212 @@
+/*
+Sphynx Operating System
+
+File: trace.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Binary trace records decoded on the host
+*/
+
+#include <sys/trace.hpp>
+#include <sys/percpu.hpp>
+#include <sys/tsc.hpp>
+#include <dev/tty.hpp>
+#include <core/mm/early.hpp>
+#include <string.hpp>
+
+extern "C" Trace::tracepoint_t __tracepoints_start[];
+extern "C" Trace::tracepoint_t __tracepoints_end[];
+
+namespace Trace {
+    static_assert(sizeof(entry_t) == 64, "trace entries are one cache line");
+    static_assert((SPHYNX_TRACE_ENTRIES & (SPHYNX_TRACE_ENTRIES - 1)) == 0, "trace ring size must be a power of two");
+
+    // A flight recorder, the newest records overwrite the oldest so the ring never refuses a writer
+    typedef struct {
+        entry_t* entries;
+        uint64_t next;
+    } ring_t;
+
+    static ring_t* rings[SPHYNX_MAX_CPUS];
+    static bool ready = false;
+
+    void init_cpu() {
+        ring_t* ring = static_cast<ring_t*>(Early::alloc(sizeof(ring_t)));
+        ring->entries = static_cast<entry_t*>(Early::alloc(SPHYNX_TRACE_ENTRIES * sizeof(entry_t), 64));
+        __atomic_store_n(&rings[PerCPU::id()], ring, __ATOMIC_RELEASE);
+        __atomic_store_n(&ready, true, __ATOMIC_RELEASE);
+    }
+
+    void record(uint32_t id, uint32_t count, const uint64_t* args) {
+        if (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+        ring_t* ring = __atomic_load_n(&rings[PerCPU::id()], __ATOMIC_RELAXED);
+        if (!ring) {
+            return;
+        }
+
+        // Only this CPU writes the ring, the atomic add keeps interrupts that trace in the middle of a record apart
+        uint64_t index = __atomic_fetch_add(&ring->next, 1, __ATOMIC_RELAXED);
+        entry_t* entry = &ring->entries[index & (SPHYNX_TRACE_ENTRIES - 1)];
+        __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+        entry->tsc = TSC::read();
+        entry->id = id;
+        entry->count = count;
+        for (uint32_t i = 0; i < count; i++) {
+            entry->args[i] = args[i];
+        }
+        __atomic_store_n(&entry->seq, index + 1, __ATOMIC_RELEASE);
+    }
+
+    void dump() {
+        bool empty = true;
+        for (uint32_t cpu = 0; cpu < SPHYNX_MAX_CPUS; cpu++) {
+            ring_t* ring = __atomic_load_n(&rings[cpu], __ATOMIC_ACQUIRE);
+            if (ring && __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE) != 0) {
+                empty = false;
+            }
+        }
+        if (empty) {
+            return;
+        }
+
+        kdprintf("TRACE-FREQ %llx\n", TSC::get_frequency());
+        for (uint32_t cpu = 0; cpu < SPHYNX_MAX_CPUS; cpu++) {
+            ring_t* ring = __atomic_load_n(&rings[cpu], __ATOMIC_ACQUIRE);
+            if (!ring) {
+                continue;
+            }
+
+            uint64_t end = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE);
+            uint64_t start = end > SPHYNX_TRACE_ENTRIES ? end - SPHYNX_TRACE_ENTRIES : 0;
+            for (uint64_t index = start; index < end; index++) {
+                const entry_t* entry = &ring->entries[index & (SPHYNX_TRACE_ENTRIES - 1)];
+                // Skips records still being written or already overwritten by a newer lap
+                if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != index + 1) {
+                    continue;
+                }
+                kdprintf("TRACE %x %llx %x", cpu, entry->tsc, entry->id);
+                for (uint32_t i = 0; i < entry->count; i++) {
+                    kdprintf(" %llx", entry->args[i]);
+                }
+                kdprintf("\n");
+            }
+        }
+        kdprintf("TRACE-END\n");
+    }
+
+    int set(const char* name, bool enabled) {
+        int found = 0;
+        for (tracepoint_t* tracepoint = __tracepoints_start; tracepoint < __tracepoints_end; tracepoint++) {
+            if (strcmp(tracepoint->name, name) != 0) {
+                continue;
+            }
+            if (enabled) {
+                StaticKey::enable(&tracepoint->key);
+            } else {
+                StaticKey::disable(&tracepoint->key);
+            }
+            found++;
+        }
+        return found;
+    }
+
+    void list() {
+        for (tracepoint_t* tracepoint = __tracepoints_start; tracepoint < __tracepoints_end; tracepoint++) {
+            // Sites sharing a name are switched together, print the name once
+            bool seen = false;
+            for (tracepoint_t* other = __tracepoints_start; other < tracepoint && !seen; other++) {
+                seen = strcmp(other->name, tracepoint->name) == 0;
+            }
+            if (seen) {
+                continue;
+            }
+            kprintf("%s %s\n", tracepoint->name, StaticKey::is_enabled(&tracepoint->key) ? "on" : "off");
+        }
+    }
+
+    // Copies the next space separated word of line into word, returns where it stopped
+    static const char* next_word(const char* line, char* word, size_t size) {
+        while (*line == ' ' || *line == '\t') {
+            line++;
+        }
+        size_t length = 0;
+        while (*line && *line != ' ' && *line != '\t') {
+            if (length + 1 < size) {
+                word[length++] = *line;
+            }
+            line++;
+        }
+        word[length] = '\0';
+        return line;
+    }
+
+    int command(const char* line) {
+        char verb[32];
+        char name[64];
+        const char* rest = next_word(line, verb, sizeof(verb));
+        next_word(rest, name, sizeof(name));
+
+        if (verb[0] == '\0') {
+            return 0;
+        }
+        if (strcmp(verb, "list") == 0) {
+            list();
+            return 0;
+        }
+
+        bool enabled = strcmp(verb, "disable") != 0;
+        if (strcmp(verb, "enable") != 0 && enabled) {
+            // A bare tracepoint name
+            strncpy(name, verb, sizeof(name));
+            name[sizeof(name) - 1] = '\0';
+        }
+        if (name[0] == '\0' || set(name, enabled) == 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    void load_config(const char* text, size_t length) {
+        char line[128];
+        size_t start = 0;
+        while (start < length) {
+            size_t end = start;
+            while (end < length && text[end] != '\n') {
+                end++;
+            }
+
+            size_t lineLength = 0;
+            for (size_t i = start; i < end && text[i] != '#' && lineLength + 1 < sizeof(line); i++) {
+                line[lineLength++] = text[i] == '\r' ? ' ' : text[i];
+            }
+            line[lineLength] = '\0';
+            if (command(line) != 0) {
+                kdprintf("trace: unknown tracepoint or command \"%s\"\n", line);
+            }
+            start = end + 1;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+/*
+Sphynx Operating System
+
+File: tsc.cpp
+Author: Kevin Alavik
+Year: 2024
+
+License: MIT License
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+Description: Time stamp counter helpers
+*/
+
+#include <sys/tsc.hpp>
+#include <dev/serial.hpp>
+
+namespace TSC {
+    #define PIT_FREQUENCY 1193182
+    #define PIT_CALIBRATION_HZ 100
+
+    static uint64_t frequency = 0;
+    static uint64_t bootTicks = 0;
+
+    void mark_boot() {
+        bootTicks = read();
+    }
+
+    void init() {
+        uint16_t count = PIT_FREQUENCY / PIT_CALIBRATION_HZ;
+
+        // Gate channel 2 on, speaker off
+        uint8_t gate = (Serial::inb(0x61) & ~0x02) | 0x01;
+        Serial::outb(0x61, gate);
+
+        // Channel 2, lobyte/hibyte, mode 0 (interrupt on terminal count)
+        Serial::outb(0x43, 0xB0);
+        Serial::outb(0x42, count & 0xFF);
+        Serial::outb(0x42, count >> 8);
+
+        // Retrigger the gate so the countdown starts now
+        Serial::outb(0x61, gate & ~0x01);
+        Serial::outb(0x61, gate | 0x01);
+
+        uint64_t start = read();
+        while (!(Serial::inb(0x61) & 0x20));
+        uint64_t end = read();
+
+        frequency = (end - start) * PIT_CALIBRATION_HZ;
+        if (bootTicks == 0) {
+            bootTicks = start;
+        }
+    }
+
+    uint64_t get_frequency() {
+        return frequency;
+    }
+
+    uint64_t ticks_to_ns(uint64_t ticks) {
+        if (frequency == 0) {
+            return 0;
+        }
+
+        // Split the conversion so ticks * 1e9 can't overflow
+        return (ticks / frequency) * 1000000000ull + ((ticks % frequency) * 1000000000ull) / frequency;
+    }
+
+    uint64_t since_boot_ns(uint64_t stamp) {
+        return stamp > bootTicks ? ticks_to_ns(stamp - bootTicks) : 0;
+    }
+
+    uint64_t get_ns() {
+        return since_boot_ns(read());
+    }
+}
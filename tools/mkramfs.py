@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+# Builds the ramfs tar with every file of at least a page starting on a page boundary, so the kernel can map it in place.
+# Alignment comes from pax headers holding only a comment record, any tar reader skips them.
+# With --compressed the image starts with a pax global header telling the kernel to decode its *.lz4 files.
+import os
+import sys
+
+BLOCK = 512
+PAGE = 4096
+
+
+def octal(value, width):
+    return f"{value:0{width - 1}o}".encode() + b"\0"
+
+
+def header(name, size, typeflag, mode):
+    name = name.encode()
+    prefix = b""
+    record = b""
+    if len(name) > 100:
+        # A directory's trailing "/" stays on the name field, splitting on it would leave that field empty
+        split = name.rfind(b"/", 0, min(156, len(name.rstrip(b"/"))))
+        if split <= 0 or len(name) - split - 1 > 100:
+            # Too long for ustar, the reader takes the full path from a GNU long name record instead
+            record, name = long_name(name), name[:100]
+        else:
+            prefix, name = name[:split], name[split + 1:]
+
+    block = bytearray(BLOCK)
+    block[0:len(name)] = name
+    block[100:108] = octal(mode, 8)
+    block[108:116] = octal(0, 8)
+    block[116:124] = octal(0, 8)
+    block[124:136] = octal(size, 12)
+    block[136:148] = octal(0, 12)
+    block[148:156] = b" " * 8
+    block[156:157] = typeflag
+    block[257:263] = b"ustar\0"
+    block[263:265] = b"00"
+    block[265:269] = b"root"
+    block[297:301] = b"root"
+    block[345:345 + len(prefix)] = prefix
+    block[148:156] = f"{sum(block):06o}".encode() + b"\0 "
+    return record + bytes(block)
+
+
+def long_name(name):
+    # GNU 'L' record, its data is the full path of the header that follows
+    data = name + b"\0"
+    return header("././@LongLink", len(data), b"L", 0o644) + padded(data)
+
+
+def padded(data):
+    return data + b"\0" * (-len(data) % BLOCK)
+
+
+def padding_entry(gap):
+    # A pax header whose records fill the gap exactly, gap is a multiple of the block size
+    size = gap - BLOCK
+    if size == 0:
+        return header("././@PaxHeader", 0, b"x", 0o644)
+    fill = size - len(" comment=\n")
+    fill -= len(str(size))
+    record = f"{size} comment={'.' * fill}\n".encode()
+    assert len(record) == size
+    return header("././@PaxHeader", size, b"x", 0o644) + record
+
+
+def pax_record(key, value):
+    # The length prefix counts itself, so grow it until it is stable
+    body = f" {key}={value}\n"
+    length = len(body)
+    while len(str(length)) + len(body) != length:
+        length = len(str(length)) + len(body)
+    return f"{length}{body}".encode()
+
+
+def build(root, out, compressed):
+    aligned = 0
+    with open(out, "wb") as f:
+        if compressed:
+            record = pax_record("SPHYNX.compression", "lz4")
+            f.write(header("././@PaxGlobalHeader", len(record), b"g", 0o644))
+            f.write(padded(record))
+
+        for directory, dirs, files in os.walk(root):
+            dirs.sort()
+            relative = os.path.relpath(directory, root)
+            if relative != ".":
+                f.write(header(relative + "/", 0, b"5", 0o755))
+
+            for name in sorted(files):
+                path = os.path.join(directory, name)
+                with open(path, "rb") as src:
+                    data = src.read()
+
+                # Compressed files are decoded into the page cache and small ones are copied anyway
+                entry = header(os.path.normpath(os.path.join(relative, name)), len(data), b"0", 0o644)
+                if len(data) >= PAGE and not name.endswith(".lz4"):
+                    gap = (PAGE - len(entry) - f.tell()) % PAGE
+                    if gap:
+                        f.write(padding_entry(gap))
+                    aligned += 1
+
+                f.write(entry)
+                f.write(padded(data))
+
+        f.write(b"\0" * BLOCK * 2)
+    return aligned
+
+
+def main():
+    args = sys.argv[1:]
+    compressed = "--compressed" in args
+    if compressed:
+        args.remove("--compressed")
+    if len(args) != 2:
+        print(f"usage: {sys.argv[0]} [--compressed] directory out.tar")
+        return 1
+
+    aligned = build(args[0], args[1], compressed)
+    print(f"{args[1]}: {aligned} page aligned files")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
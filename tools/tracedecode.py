@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# Decodes the TRACE lines Trace::dump writes to the debug port, using the format strings in the kernel's .trace_fmt section
+import re
+import struct
+import sys
+
+FORMAT = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXpcs%])")
+LINE = re.compile(r"TRACE ([0-9a-f]+) ([0-9a-f]+) ([0-9a-f]+)((?: [0-9a-f]+)*)\s*$")
+FREQ = re.compile(r"TRACE-FREQ ([0-9a-f]+)")
+
+
+def read_section(path, wanted):
+    with open(path, "rb") as f:
+        elf = f.read()
+    if elf[:4] != b"\x7fELF" or elf[4] != 2:
+        raise ValueError(f"{path} is not a 64 bit ELF")
+
+    shoff, = struct.unpack_from("<Q", elf, 0x28)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", elf, 0x3A)
+    sections = [struct.unpack_from("<IIQQQQIIQQ", elf, shoff + i * shentsize) for i in range(shnum)]
+    names = sections[shstrndx]
+    for section in sections:
+        start = names[4] + section[0]
+        name = elf[start:elf.index(b"\0", start)].decode()
+        if name == wanted:
+            return elf[section[4]:section[4] + section[5]]
+    raise ValueError(f"{path} has no {wanted} section")
+
+
+def to_signed(value, length):
+    bits = {"hh": 8, "h": 16, "ll": 64, "l": 64, "z": 64, "j": 64, "t": 64}.get(length, 32)
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def render(fmt, args):
+    words = iter(args)
+
+    def convert(match):
+        flags, width, precision, length, kind = match.groups()
+        if kind == "%":
+            return "%"
+        value = next(words, 0)
+        if kind in "di":
+            value = to_signed(value, length)
+            kind = "d"
+        elif kind == "u":
+            kind = "d"
+        elif kind == "p" or kind == "s":
+            return f"0x{value:x}"
+        elif kind == "c":
+            value = chr(value & 0xFF)
+        spec = f"%{flags}{width}{'.' + precision if precision else ''}{kind}"
+        return spec % value
+
+    return FORMAT.sub(convert, fmt)
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(f"usage: {sys.argv[0]} kernel.elf [debug log, default stdin]")
+        return 1
+
+    strings = read_section(sys.argv[1], ".trace_fmt")
+    log = open(sys.argv[2], errors="replace") if len(sys.argv) > 2 else sys.stdin
+
+    frequency = 0
+    records = []
+    for line in log:
+        match = FREQ.search(line)
+        if match:
+            frequency = int(match.group(1), 16)
+            continue
+        match = LINE.search(line)
+        if match:
+            cpu, tsc, offset = (int(v, 16) for v in match.group(1, 2, 3))
+            args = [int(v, 16) for v in match.group(4).split()]
+            records.append((tsc, cpu, offset, args))
+
+    if not records:
+        print("no trace records found")
+        return 1
+
+    records.sort()
+    base = records[0][0]
+    for tsc, cpu, offset, args in records:
+        if offset >= len(strings):
+            text = f"<unknown format {offset:#x}> {' '.join(hex(a) for a in args)}"
+        else:
+            text = render(strings[offset:strings.index(b"\0", offset)].decode(errors="replace"), args)
+        stamp = f"{(tsc - base) * 1e6 / frequency:14.3f} us" if frequency else f"{tsc - base:16d} tsc"
+        print(f"[{stamp}] cpu{cpu}: {text}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())